@@ -0,0 +1,125 @@
+// arena.h
+// Bump allocator for objects that share one lifetime.
+//
+// Memory comes from blocks that are only released by the destructor;
+// reset() rewinds to the first block, so an arena that is reused for
+// work of the same shape stops allocating after the first round.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dx {
+
+class arena
+{
+	struct destructor
+	{
+		void (*destroy)(void*);
+		void* object;
+		destructor* next;
+	};
+
+public:
+	explicit arena(std::size_t block_size = 4096)
+		: _block_size(block_size), _block(0), _used(0), _destructors(nullptr)
+	{
+	}
+
+	~arena()
+	{
+		run_destructors();
+	}
+
+	arena(const arena&) = delete;
+	arena& operator=(const arena&) = delete;
+
+	void* allocate(std::size_t size, std::size_t align = alignof(std::max_align_t))
+	{
+		for (;;)
+		{
+			if (_block < _blocks.size())
+			{
+				block& b = _blocks[_block];
+				std::uintptr_t at = reinterpret_cast<std::uintptr_t>(b.data.get()) + _used;
+				std::size_t pad = std::size_t((align - at % align) % align);
+				if (_used + pad + size <= b.size)
+				{
+					_used += pad + size;
+					return b.data.get() + _used - size;
+				}
+				++_block;
+				_used = 0;
+				continue;
+			}
+			std::size_t n = size + align > _block_size ? size + align : _block_size;
+			_blocks.push_back(block{ std::unique_ptr<char[]>(new char[n]), n });
+		}
+	}
+
+	// Constructs a T in the arena; its destructor runs on reset() or
+	// when the arena is destroyed.
+	template <class T, class... Args>
+	T* create(Args&&... args)
+	{
+		T* p = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if (!std::is_trivially_destructible<T>::value)
+		{
+			destructor* d = static_cast<destructor*>(allocate(sizeof(destructor), alignof(destructor)));
+			d->destroy = [](void* o) { static_cast<T*>(o)->~T(); };
+			d->object = p;
+			d->next = _destructors;
+			_destructors = d;
+		}
+		return p;
+	}
+
+	// Uninitialized storage for n objects of type T.
+	template <class T>
+	T* allocate_array(std::size_t n)
+	{
+		return static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+	}
+
+	// Destroys everything and rewinds; keeps the blocks for reuse.
+	void reset()
+	{
+		run_destructors();
+		_block = 0;
+		_used = 0;
+	}
+
+	std::size_t capacity() const
+	{
+		std::size_t n = 0;
+		for (auto& b : _blocks)
+			n += b.size;
+		return n;
+	}
+
+private:
+	struct block
+	{
+		std::unique_ptr<char[]> data;
+		std::size_t size;
+	};
+
+	void run_destructors()
+	{
+		for (destructor* d = _destructors; d; d = d->next)
+			d->destroy(d->object);
+		_destructors = nullptr;
+	}
+
+	std::size_t _block_size;
+	std::vector<block> _blocks;
+	std::size_t _block;
+	std::size_t _used;
+	destructor* _destructors;
+};
+
+} // namespace dx
@@ -0,0 +1,325 @@
+// batch_find.h
+// parallel_find_first_of_each: the first position of each of many keys in
+// one parallel pass over the range.
+//
+// The pass runs on the chunked search of find.h. Every key has its own
+// best position, lowered with an atomic min like the single-key
+// parallel_find_first. Before each block a key is active only while its
+// best lies right of the block, so a key costs nothing from the first
+// block after it was found. Once every key has been found, the search
+// bound drops to the largest best position and the pass stops there.
+//
+// Up to batch_small_keys active keys are compared directly. On contiguous
+// 32-bit integers with AVX2, each one is broadcast to a register and eight
+// elements at a time are compared against all of them; only the lanes
+// that equal some key are looked at again. More keys go through a blocked
+// Bloom filter of 8 bits per key, with both probe bits in one 64-bit word,
+// and the elements that pass it through an open-addressed hash table of
+// the keys. Both stay in L1/L2 for thousands of keys. There a found key
+// costs a table probe only where its value appears again.
+#pragma once
+#include "ppl.h"
+#include "find.h"
+#include "cpu_features.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace dx {
+
+namespace detail {
+
+// Active keys up to this many are compared directly.
+const std::size_t batch_small_keys = 16;
+
+namespace scalar_kernels {
+
+// Writes the offsets of the elements of p[0..n) equal to one of keys[0..m)
+// to hits; returns how many there are.
+inline std::size_t match_keys(const std::int32_t* p, std::size_t n, const std::int32_t* keys, std::size_t m,
+	std::uint32_t* hits)
+{
+	std::size_t h = 0;
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		for (std::size_t k = 0; k < m; ++k)
+		{
+			if (p[i] == keys[k])
+			{
+				hits[h++] = std::uint32_t(i);
+				break;
+			}
+		}
+	}
+	return h;
+}
+
+} // namespace scalar_kernels
+
+#ifdef DX_X86_SIMD
+
+namespace avx2_kernels {
+
+DX_TARGET_AVX2 inline std::size_t match_keys(const std::int32_t* p, std::size_t n, const std::int32_t* keys,
+	std::size_t m, std::uint32_t* hits)
+{
+	__m256i k[batch_small_keys];
+	for (std::size_t j = 0; j < m; ++j)
+		k[j] = _mm256_set1_epi32(keys[j]);
+	std::size_t h = 0, i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+		__m256i eq = _mm256_cmpeq_epi32(v, k[0]);
+		for (std::size_t j = 1; j < m; ++j)
+			eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(v, k[j]));
+		unsigned mask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(eq)));
+		for (std::uint32_t j = 0; mask; ++j, mask >>= 1)
+		{
+			if (mask & 1)
+				hits[h++] = std::uint32_t(i) + j;
+		}
+	}
+	const std::size_t tail = scalar_kernels::match_keys(p + i, n - i, keys, m, hits + h);
+	for (std::size_t t = 0; t < tail; ++t)
+		hits[h + t] += std::uint32_t(i);
+	return h + tail;
+}
+
+} // namespace avx2_kernels
+
+#endif // DX_X86_SIMD
+
+typedef std::size_t (*match_keys_fn)(const std::int32_t*, std::size_t, const std::int32_t*, std::size_t,
+	std::uint32_t*);
+
+inline match_keys_fn select_match_keys()
+{
+#ifdef DX_X86_SIMD
+	if (cpu_simd_level() >= simd_level::avx2)
+		return &avx2_kernels::match_keys;
+#endif
+	return &scalar_kernels::match_keys;
+}
+
+// Whether the broadcast kernels can read [It, It + n) as int32_t.
+template <class It, class T = typename std::iterator_traits<It>::value_type>
+struct uses_simd_keys : std::integral_constant<bool, is_contiguous<It>::value && std::is_integral<T>::value
+	&& sizeof(T) == 4>
+{
+};
+
+// The distinct keys, an index for each, and the Bloom filter in front of
+// them.
+template <class T>
+class key_table
+{
+public:
+	// Adds the distinct keys of [first, last) and gives slot[j] the index
+	// of the j-th key.
+	template <class KeyIt>
+	key_table(KeyIt first, KeyIt last, std::vector<std::size_t>& slot)
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		std::size_t cap = 16;
+		while (cap < 2 * n)
+			cap *= 2;
+		_mask = cap - 1;
+		_index.assign(cap, -1);
+		_keys.reserve(n);
+		std::size_t words = 8;
+		while (words * 64 < 8 * n)
+			words *= 2;
+		_bloom_mask = words - 1;
+		_bloom.assign(words, 0);
+
+		slot.clear();
+		for (; first != last; ++first)
+		{
+			const T& key = *first;
+			const std::uint64_t h = hash(key);
+			std::size_t i = std::size_t(h >> 32) & _mask;
+			while (_index[i] >= 0 && !(_keys[std::size_t(_index[i])] == key))
+				i = (i + 1) & _mask;
+			if (_index[i] < 0)
+			{
+				_index[i] = std::ptrdiff_t(_keys.size());
+				_keys.push_back(key);
+				_bloom[std::size_t(h) & _bloom_mask] |= bloom_bits(h);
+			}
+			slot.push_back(std::size_t(_index[i]));
+		}
+	}
+
+	std::size_t size() const { return _keys.size(); }
+	const std::vector<T>& keys() const { return _keys; }
+
+	// Index of v among the keys, or -1.
+	std::ptrdiff_t find(const T& v) const
+	{
+		const std::uint64_t h = hash(v);
+		const std::uint64_t bits = bloom_bits(h);
+		if ((_bloom[std::size_t(h) & _bloom_mask] & bits) != bits)
+			return -1;
+		for (std::size_t i = std::size_t(h >> 32) & _mask;; i = (i + 1) & _mask)
+		{
+			const std::ptrdiff_t k = _index[i];
+			if (k < 0 || _keys[std::size_t(k)] == v)
+				return k;
+		}
+	}
+
+private:
+	static std::uint64_t hash(const T& v)
+	{
+		const std::uint64_t h = std::uint64_t(std::hash<T>()(v)) * 0x9e3779b97f4a7c15ull;
+		return h ^ (h >> 29);
+	}
+
+	// Two bits of a Bloom word, from bits the word index and the table
+	// slot do not use.
+	static std::uint64_t bloom_bits(std::uint64_t h)
+	{
+		return (std::uint64_t(1) << ((h >> 20) & 63)) | (std::uint64_t(1) << ((h >> 26) & 63));
+	}
+
+	std::vector<T> _keys;
+	std::vector<std::ptrdiff_t> _index;
+	std::size_t _mask;
+	std::vector<std::uint64_t> _bloom;
+	std::size_t _bloom_mask;
+};
+
+// Per-key best positions of one batch search.
+class key_positions
+{
+public:
+	key_positions(std::size_t keys, std::size_t n, search& s)
+		: _best(new std::atomic<std::size_t>[keys]), _keys(keys), _n(n), _found(0), _search(s)
+	{
+		for (std::size_t k = 0; k < keys; ++k)
+			_best[k].store(n, std::memory_order_relaxed);
+	}
+
+	std::size_t best(std::size_t k) const { return _best[k].load(std::memory_order_relaxed); }
+
+	// Key k is at position i. The first time every key has been found,
+	// the search is bounded by the last of them.
+	void hit(std::size_t k, std::size_t i)
+	{
+		std::size_t cur = _best[k].load(std::memory_order_relaxed);
+		while (i < cur)
+		{
+			if (_best[k].compare_exchange_weak(cur, i, std::memory_order_relaxed))
+			{
+				if (cur == _n && _found.fetch_add(1, std::memory_order_relaxed) + 1 == _keys)
+				{
+					std::size_t bound = 0;
+					for (std::size_t j = 0; j < _keys; ++j)
+						bound = (std::max)(bound, best(j));
+					_search.found(bound);
+				}
+				return;
+			}
+		}
+	}
+
+private:
+	std::unique_ptr<std::atomic<std::size_t>[]> _best;
+	std::size_t _keys;
+	std::size_t _n;
+	std::atomic<std::size_t> _found;
+	search& _search;
+};
+
+} // namespace detail
+
+// For each key of [keys_first, keys_last), the first element of
+// [first, last) equal to it, or last; in the order of the keys.
+template <class It, class KeyIt>
+std::vector<It> parallel_find_first_of_each(It first, It last, KeyIt keys_first, KeyIt keys_last)
+{
+	typedef typename std::iterator_traits<It>::value_type T;
+	std::vector<std::size_t> slot;
+	const detail::key_table<T> table(keys_first, keys_last, slot);
+	const std::size_t keys = table.size();
+	std::vector<It> result(slot.size(), last);
+	// An empty range finds nothing, and has no first element to point at.
+	if (keys == 0 || first == last)
+		return result;
+
+	if constexpr (!detail::is_random_access<It>::value)
+	{
+		std::vector<It> at(keys, last);
+		std::size_t missing = keys;
+		for (It it = first; it != last && missing != 0; ++it)
+		{
+			const std::ptrdiff_t k = table.find(*it);
+			if (k >= 0 && at[std::size_t(k)] == last)
+			{
+				at[std::size_t(k)] = it;
+				--missing;
+			}
+		}
+		for (std::size_t j = 0; j < slot.size(); ++j)
+			result[j] = at[slot[j]];
+		return result;
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		detail::search s(n);
+		detail::key_positions pos(keys, n, s);
+		const std::vector<T>& key = table.keys();
+		if constexpr (detail::uses_simd_keys<It>::value)
+		{
+			if (keys <= detail::batch_small_keys)
+			{
+				const detail::match_keys_fn match = detail::select_match_keys();
+				const std::int32_t* p = reinterpret_cast<const std::int32_t*>(std::addressof(*first));
+				s.run([&](std::size_t lo, std::size_t hi) {
+					std::int32_t active[detail::batch_small_keys];
+					std::size_t m = 0;
+					for (std::size_t k = 0; k < keys; ++k)
+					{
+						if (pos.best(k) > lo)
+							active[m++] = std::int32_t(key[k]);
+					}
+					if (m == 0)
+						return false;
+					std::uint32_t hits[detail::search::block_size];
+					const std::size_t h = match(p + lo, hi - lo, active, m, hits);
+					for (std::size_t j = 0; j < h; ++j)
+					{
+						const std::size_t i = lo + hits[j];
+						pos.hit(std::size_t(table.find(first[i])), i);
+					}
+					return true;
+				});
+				for (std::size_t j = 0; j < slot.size(); ++j)
+					result[j] = std::next(first, pos.best(slot[j]));
+				return result;
+			}
+		}
+		s.run([&](std::size_t lo, std::size_t hi) {
+			for (std::size_t i = lo; i < hi; ++i)
+			{
+				const std::ptrdiff_t k = table.find(first[i]);
+				if (k >= 0 && i < pos.best(std::size_t(k)))
+					pos.hit(std::size_t(k), i);
+			}
+			return true;
+		});
+		for (std::size_t j = 0; j < slot.size(); ++j)
+			result[j] = std::next(first, pos.best(slot[j]));
+		return result;
+	}
+}
+
+} // namespace dx
@@ -0,0 +1,407 @@
+// bench.h
+// Benchmark harness for the samples.
+//
+// A suite holds named benchmarks. Each one runs a few untimed warm-up
+// rounds and then a number of timed trials on a monotonic nanosecond
+// clock; the report gives the median and the 95th/99th percentiles of the
+// trials instead of a single millisecond reading. Parallel benchmarks are
+// swept over thread counts with scheduler::set_concurrency() and report
+//
+//   speedup     Sp = T1 / Tp
+//   efficiency  E  = Sp / p
+//
+// where T1 is the median of the serial baseline of the benchmark's group
+// (the last serial benchmark added before it since group() was called) if
+// there is one, and of the benchmark's own one-thread run otherwise.
+//
+// Command line of a suite's run():
+//   --trials N      timed runs per benchmark and thread count
+//   --warmup N      untimed runs before them
+//   --threads LIST  thread counts to sweep, e.g. 1,2,4 (default: powers of
+//                   two up to the pool size, and the pool size)
+//   --filter TEXT   only benchmarks whose name contains TEXT
+//   --json FILE     also write the results as JSON to FILE ("-" for stdout)
+//   --perf          after the trials, run once more under perf_call() and
+//                   print the per-thread counters (see perf_counters.h)
+#pragma once
+#include "ppl.h"
+#include "perf_counters.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace dx {
+namespace bench {
+
+// Monotonic clock in nanoseconds.
+inline std::uint64_t now_ns()
+{
+	return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Summary of the trial times of one benchmark, in milliseconds.
+struct stats
+{
+	std::size_t trials = 0;
+	double min = 0;
+	double mean = 0;
+	double median = 0;
+	double p95 = 0;
+	double p99 = 0;
+};
+
+// Nearest-rank percentile of sorted samples.
+inline double percentile(const std::vector<double>& sorted, double q)
+{
+	if (sorted.empty())
+		return 0;
+	std::size_t rank = std::size_t(std::ceil(q * double(sorted.size())));
+	return sorted[rank ? rank - 1 : 0];
+}
+
+inline stats summarize(std::vector<double> ms)
+{
+	stats s;
+	s.trials = ms.size();
+	if (ms.empty())
+		return s;
+	std::sort(ms.begin(), ms.end());
+	s.min = ms.front();
+	double sum = 0;
+	for (double t : ms)
+		sum += t;
+	s.mean = sum / double(ms.size());
+	std::size_t n = ms.size();
+	s.median = n % 2 ? ms[n / 2] : (ms[n / 2 - 1] + ms[n / 2]) / 2;
+	s.p95 = percentile(ms, 0.95);
+	s.p99 = percentile(ms, 0.99);
+	return s;
+}
+
+// Runs setup (untimed) and run (timed) warmup + trials times.
+inline stats measure(const std::function<void()>& setup, const std::function<void()>& run,
+	unsigned warmup, unsigned trials)
+{
+	for (unsigned i = 0; i < warmup; ++i)
+	{
+		if (setup)
+			setup();
+		run();
+	}
+	std::vector<double> ms;
+	ms.reserve(trials);
+	for (unsigned i = 0; i < trials; ++i)
+	{
+		if (setup)
+			setup();
+		std::uint64_t begin = now_ns();
+		run();
+		ms.push_back(double(now_ns() - begin) / 1e6);
+	}
+	return summarize(std::move(ms));
+}
+
+struct result
+{
+	std::string group;
+	std::string name;
+	unsigned threads;
+	bool parallel;
+	stats time;
+	double speedup; // 0 when there is no T1 to compare with
+	double efficiency;
+	perf_report counters; // filled with --perf
+};
+
+class suite
+{
+	struct benchmark
+	{
+		std::string group;
+		std::string name;
+		std::function<void()> setup;
+		std::function<void()> run;
+		bool parallel;
+		int baseline; // index of the serial benchmark giving T1, or -1
+	};
+
+public:
+	explicit suite(std::string name, unsigned warmup = 1, unsigned trials = 10)
+		: _name(std::move(name)), _warmup(warmup), _trials(trials), _baseline(-1)
+	{
+	}
+
+	// Starts a group of benchmarks that are compared with each other;
+	// benchmarks added afterwards no longer use earlier serial baselines.
+	suite& group(std::string name)
+	{
+		_group = std::move(name);
+		_baseline = -1;
+		return *this;
+	}
+
+	// Parallel benchmark, swept over thread counts. setup runs untimed
+	// before every trial, e.g. to restore the input of an in-place sort.
+	suite& add(std::string name, std::function<void()> run)
+	{
+		return add(std::move(name), nullptr, std::move(run));
+	}
+
+	suite& add(std::string name, std::function<void()> setup, std::function<void()> run)
+	{
+		_benchmarks.push_back(benchmark{ _group, std::move(name), std::move(setup), std::move(run), true, _baseline });
+		return *this;
+	}
+
+	// Serial benchmark, run on one thread. It is the T1 of the parallel
+	// benchmarks added after it in the same group.
+	suite& add_serial(std::string name, std::function<void()> run)
+	{
+		return add_serial(std::move(name), nullptr, std::move(run));
+	}
+
+	suite& add_serial(std::string name, std::function<void()> setup, std::function<void()> run)
+	{
+		_baseline = int(_benchmarks.size());
+		_benchmarks.push_back(benchmark{ _group, std::move(name), std::move(setup), std::move(run), false, -1 });
+		return *this;
+	}
+
+	// Parses the command line, runs the selected benchmarks, prints a table
+	// and optionally writes JSON. Returns the exit code for main.
+	int run(int argc, char* argv[])
+	{
+		std::string json_path, filter;
+		std::vector<unsigned> threads;
+		bool perf = false;
+		for (int i = 1; i < argc; ++i)
+		{
+			auto value = [&]() -> const char* {
+				if (i + 1 >= argc)
+				{
+					std::cerr << argv[i] << " needs a value\n";
+					std::exit(2);
+				}
+				return argv[++i];
+			};
+			if (std::strcmp(argv[i], "--trials") == 0)
+				_trials = unsigned(std::atoi(value()));
+			else if (std::strcmp(argv[i], "--warmup") == 0)
+				_warmup = unsigned(std::atoi(value()));
+			else if (std::strcmp(argv[i], "--threads") == 0)
+				threads = parse_list(value());
+			else if (std::strcmp(argv[i], "--filter") == 0)
+				filter = value();
+			else if (std::strcmp(argv[i], "--json") == 0)
+				json_path = value();
+			else if (std::strcmp(argv[i], "--perf") == 0)
+				perf = true;
+			else
+			{
+				std::cerr << "usage: " << argv[0]
+					<< " [--trials N] [--warmup N] [--threads 1,2,4] [--filter TEXT] [--json FILE] [--perf]\n";
+				return 2;
+			}
+		}
+		if (_trials == 0)
+			_trials = 1;
+
+		scheduler& sched = scheduler::instance();
+		if (threads.empty())
+			threads = default_threads(sched.max_concurrency());
+
+		std::vector<result> results;
+		std::vector<double> medians(_benchmarks.size(), 0);
+		print_header(threads);
+		const std::string* group = nullptr;
+		for (std::size_t i = 0; i < _benchmarks.size(); ++i)
+		{
+			const benchmark& b = _benchmarks[i];
+			if (!filter.empty() && b.name.find(filter) == std::string::npos)
+				continue;
+			if (!group || *group != b.group)
+			{
+				group = &b.group;
+				if (!b.group.empty())
+					std::cout << "[" << b.group << "]\n";
+			}
+			if (!b.parallel)
+			{
+				sched.set_concurrency(1);
+				result r{ b.group, b.name, 1, false, measure(b.setup, b.run, _warmup, _trials), 0, 0, {} };
+				medians[i] = r.time.median;
+				print(r);
+				if (perf)
+					count(b, r);
+				results.push_back(r);
+				continue;
+			}
+			double t1 = b.baseline >= 0 ? medians[b.baseline] : 0;
+			for (unsigned p : threads)
+			{
+				sched.set_concurrency(p);
+				result r{ b.group, b.name, sched.concurrency(), true, measure(b.setup, b.run, _warmup, _trials), 0, 0, {} };
+				if (t1 == 0 && r.threads == 1)
+					t1 = r.time.median;
+				if (t1 > 0 && r.time.median > 0)
+				{
+					r.speedup = t1 / r.time.median;
+					r.efficiency = r.speedup / r.threads;
+				}
+				print(r);
+				if (perf)
+					count(b, r);
+				results.push_back(r);
+			}
+		}
+		sched.set_concurrency(sched.max_concurrency());
+		std::cout << std::endl;
+
+		if (!json_path.empty())
+		{
+			if (json_path == "-")
+			{
+				write_json(std::cout, results);
+			}
+			else
+			{
+				std::ofstream out(json_path);
+				write_json(out, results);
+				if (!out)
+				{
+					std::cerr << "cannot write " << json_path << "\n";
+					return 1;
+				}
+			}
+		}
+		return 0;
+	}
+
+private:
+	static std::vector<unsigned> parse_list(const char* s)
+	{
+		std::vector<unsigned> v;
+		while (*s)
+		{
+			char* end;
+			unsigned long n = std::strtoul(s, &end, 10);
+			if (end == s)
+				break;
+			if (n > 0)
+				v.push_back(unsigned(n));
+			s = *end == ',' ? end + 1 : end;
+		}
+		return v;
+	}
+
+	static std::vector<unsigned> default_threads(unsigned max)
+	{
+		std::vector<unsigned> v;
+		for (unsigned p = 1; p < max; p *= 2)
+			v.push_back(p);
+		v.push_back(max);
+		return v;
+	}
+
+	void print_header(const std::vector<unsigned>& threads) const
+	{
+		std::cout << _name << ": " << _warmup << " warm-up, " << _trials << " trials, threads";
+		for (unsigned p : threads)
+			std::cout << ' ' << p;
+		std::cout << "\n";
+		char line[160];
+		std::snprintf(line, sizeof(line), "%-32s %4s %12s %12s %12s %8s %6s\n",
+			"benchmark", "p", "median ms", "p95 ms", "p99 ms", "Sp", "E");
+		std::cout << line;
+	}
+
+	static void print(const result& r)
+	{
+		char line[160];
+		int n = std::snprintf(line, sizeof(line), "%-32s %4u %12.3f %12.3f %12.3f",
+			r.name.c_str(), r.threads, r.time.median, r.time.p95, r.time.p99);
+		if (r.speedup > 0)
+			std::snprintf(line + n, sizeof(line) - n, " %8.2f %6.2f", r.speedup, r.efficiency);
+		std::cout << line << std::endl;
+	}
+
+	// One more run of b under perf_call, printed below its row.
+	static void count(const benchmark& b, result& r)
+	{
+		if (b.setup)
+			b.setup();
+		r.counters = perf_call(b.run);
+		r.counters.print(std::cout);
+		std::cout << std::endl;
+	}
+
+	static std::string quote(const std::string& s)
+	{
+		std::string q = "\"";
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\')
+				q += '\\';
+			q += c;
+		}
+		return q + "\"";
+	}
+
+	void write_json(std::ostream& out, const std::vector<result>& results) const
+	{
+		out << "{\"suite\": " << quote(_name) << ", \"warmup\": " << _warmup
+			<< ", \"trials\": " << _trials << ", \"results\": [";
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			const result& r = results[i];
+			out << (i ? ",\n  " : "\n  ")
+				<< "{\"group\": " << quote(r.group)
+				<< ", \"name\": " << quote(r.name)
+				<< ", \"threads\": " << r.threads
+				<< ", \"parallel\": " << (r.parallel ? "true" : "false")
+				<< ", \"min_ms\": " << r.time.min
+				<< ", \"mean_ms\": " << r.time.mean
+				<< ", \"median_ms\": " << r.time.median
+				<< ", \"p95_ms\": " << r.time.p95
+				<< ", \"p99_ms\": " << r.time.p99;
+			if (r.speedup > 0)
+				out << ", \"speedup\": " << r.speedup << ", \"efficiency\": " << r.efficiency;
+			if (r.counters.counters)
+			{
+				out << ", \"counters\": {";
+				const char* sep = "";
+				for (int e = 0; e < perf_event_count; ++e)
+				{
+					if (r.counters.total.valid[e])
+					{
+						out << sep << quote(perf_event_name(e)) << ": " << r.counters.total.value[e];
+						sep = ", ";
+					}
+				}
+				out << "}";
+			}
+			out << "}";
+		}
+		out << "\n]}\n";
+	}
+
+	std::string _name;
+	unsigned _warmup;
+	unsigned _trials;
+	std::vector<benchmark> _benchmarks;
+	std::string _group;
+	int _baseline;
+};
+
+} // namespace bench
+} // namespace dx
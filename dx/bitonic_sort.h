@@ -0,0 +1,239 @@
+// bitonic_sort.h
+// Serial and parallel bitonic sort of an array of any length.
+//
+// Lengths that are not a power of two use H. W. Lang's variant of the
+// network: a sequence is split at the largest power of two below its
+// length, and the merge compares element i with i + m only where i + m
+// exists. That is the power-of-two network run on the sequence padded
+// with sentinels that sort after every element, except that the
+// sentinels are never stored or touched, so no padded copy is made and
+// no compare-swap is spent on them. Blocks of 8, 16 or 32 elements go
+// through the in-register networks of sort_network.h when there is one
+// for the element type.
+//
+// Besides plain elements, the sorts take keys with a separate payload
+// array or elements with a key projection; see the overloads at the end.
+#pragma once
+#include "ppl.h"
+#include "sort_network.h"
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace dx {
+
+namespace detail {
+
+// Largest power of two below n, for n > 1.
+inline std::ptrdiff_t bitonic_split(std::ptrdiff_t n)
+{
+	std::ptrdiff_t m = 1;
+	while (m < n - m)
+		m *= 2;
+	return m;
+}
+
+// What the sorts run on: the elements themselves, keys with a payload
+// array (struct of arrays, the keys stay contiguous for the networks), or
+// elements ordered by a projection. greater(i, j) compares, exchange(i, j)
+// moves everything belonging to positions i and j, and network_sort /
+// network_merge take blocks of 8 to 32 when sort_network.h has a network.
+template <class T>
+struct bitonic_items
+{
+	T* items;
+
+	bool greater(std::ptrdiff_t i, std::ptrdiff_t j) const { return items[j] < items[i]; }
+	void exchange(std::ptrdiff_t i, std::ptrdiff_t j) const { std::swap(items[i], items[j]); }
+	bool network_sort(std::ptrdiff_t lo, std::ptrdiff_t n, bool ascending) const
+	{
+		return dx::network_sort(items + lo, int(n), ascending);
+	}
+	bool network_merge(std::ptrdiff_t lo, std::ptrdiff_t n, bool ascending) const
+	{
+		return dx::network_merge(items + lo, int(n), ascending);
+	}
+};
+
+// Payloads move only when their keys do.
+template <class K, class V>
+struct bitonic_key_values
+{
+	K* keys;
+	V* values;
+
+	bool greater(std::ptrdiff_t i, std::ptrdiff_t j) const { return keys[j] < keys[i]; }
+	void exchange(std::ptrdiff_t i, std::ptrdiff_t j) const
+	{
+		std::swap(keys[i], keys[j]);
+		std::swap(values[i], values[j]);
+	}
+	bool network_sort(std::ptrdiff_t lo, std::ptrdiff_t n, bool ascending) const
+	{
+		return dx::network_sort(keys + lo, values + lo, int(n), ascending);
+	}
+	bool network_merge(std::ptrdiff_t lo, std::ptrdiff_t n, bool ascending) const
+	{
+		return dx::network_merge(keys + lo, values + lo, int(n), ascending);
+	}
+};
+
+template <class T, class Proj>
+struct bitonic_projected
+{
+	T* items;
+	Proj proj;
+
+	bool greater(std::ptrdiff_t i, std::ptrdiff_t j) const { return proj(items[j]) < proj(items[i]); }
+	void exchange(std::ptrdiff_t i, std::ptrdiff_t j) const { std::swap(items[i], items[j]); }
+	bool network_sort(std::ptrdiff_t, std::ptrdiff_t, bool) const { return false; }
+	bool network_merge(std::ptrdiff_t, std::ptrdiff_t, bool) const { return false; }
+};
+
+template <class S>
+inline void bitonic_compare(const S& s, std::ptrdiff_t i, std::ptrdiff_t j, bool ascending)
+{
+	if (ascending == s.greater(i, j))
+		s.exchange(i, j);
+}
+
+// Sorts s[lo, lo + n), which holds a sequence sorted against `ascending`
+// followed by one sorted along it.
+template <class S>
+void bitonic_merge(const S& s, std::ptrdiff_t lo, std::ptrdiff_t n, bool ascending)
+{
+	if (n <= 32 && s.network_merge(lo, n, ascending))
+		return;
+	if (n > 1)
+	{
+		std::ptrdiff_t m = bitonic_split(n);
+		for (std::ptrdiff_t i = lo; i < lo + n - m; ++i)
+			bitonic_compare(s, i, i + m, ascending);
+		bitonic_merge(s, lo, m, ascending);
+		bitonic_merge(s, lo + m, n - m, ascending);
+	}
+}
+
+template <class S>
+void bitonic_sort(const S& s, std::ptrdiff_t lo, std::ptrdiff_t n, bool ascending)
+{
+	if (n <= 32 && s.network_sort(lo, n, ascending))
+		return;
+	if (n > 1)
+	{
+		// The power-of-two part first, so the recursion ends in blocks the
+		// networks take.
+		std::ptrdiff_t m = bitonic_split(n);
+		bitonic_sort(s, lo, m, !ascending);
+		bitonic_sort(s, lo + m, n - m, ascending);
+		bitonic_merge(s, lo, n, ascending);
+	}
+}
+
+// Pieces of the sort smaller than this are sorted and merged serially:
+// enough compare-swaps to pay for a task, and about eight pieces per
+// worker so the load balances. One worker sorts everything serially.
+inline std::ptrdiff_t bitonic_grain(std::ptrdiff_t size)
+{
+	std::ptrdiff_t p = std::ptrdiff_t(scheduler::instance().concurrency());
+	if (p == 1)
+		return size;
+	return (std::max)(std::ptrdiff_t(2048), size / (8 * p));
+}
+
+template <class S>
+void parallel_bitonic_merge(const S& s, std::ptrdiff_t lo, std::ptrdiff_t n, bool ascending, std::ptrdiff_t grain)
+{
+	if (n > grain)
+	{
+		std::ptrdiff_t m = bitonic_split(n);
+
+		// Split the compare phase across the workers too, so the top-level
+		// merge does not run n/2 compare-swaps on one thread.
+		std::ptrdiff_t pairs = n - m;
+		std::ptrdiff_t chunks = (pairs + grain - 1) / grain;
+		parallel_for(std::ptrdiff_t(0), chunks, [=, &s](std::ptrdiff_t c) {
+			std::ptrdiff_t first = lo + c * grain;
+			std::ptrdiff_t last = (std::min)(lo + pairs, first + grain);
+			for (std::ptrdiff_t i = first; i < last; ++i)
+				bitonic_compare(s, i, i + m, ascending);
+		});
+
+		parallel_invoke(
+			[=, &s] { parallel_bitonic_merge(s, lo, m, ascending, grain); },
+			[=, &s] { parallel_bitonic_merge(s, lo + m, n - m, ascending, grain); });
+	}
+	else
+	{
+		bitonic_merge(s, lo, n, ascending);
+	}
+}
+
+template <class S>
+void parallel_bitonic_sort(const S& s, std::ptrdiff_t lo, std::ptrdiff_t n, bool ascending, std::ptrdiff_t grain)
+{
+	if (n > grain)
+	{
+		std::ptrdiff_t m = bitonic_split(n);
+		parallel_invoke(
+			[=, &s] { parallel_bitonic_sort(s, lo, m, !ascending, grain); },
+			[=, &s] { parallel_bitonic_sort(s, lo + m, n - m, ascending, grain); });
+		parallel_bitonic_merge(s, lo, n, ascending, grain);
+	}
+	else
+	{
+		bitonic_sort(s, lo, n, ascending);
+	}
+}
+
+} // namespace detail
+
+// Sorts items[0, size) in place, in increasing order unless ascending is
+// false. Any size.
+template <class T>
+void bitonic_sort(T* items, std::ptrdiff_t size, bool ascending = true)
+{
+	detail::bitonic_sort(detail::bitonic_items<T>{ items }, 0, size, ascending);
+}
+
+// Sorts keys[0, size) and moves values[i] along with keys[i]. The keys
+// stay one contiguous array, so 32- and 64-bit keys with payloads of the
+// same width still go through the vector networks; other payloads are
+// swapped element by element.
+template <class K, class V>
+void bitonic_sort(K* keys, V* values, std::ptrdiff_t size, bool ascending = true)
+{
+	detail::bitonic_sort(detail::bitonic_key_values<K, V>{ keys, values }, 0, size, ascending);
+}
+
+// Sorts items[0, size) by proj(item), comparing the projections with <.
+// Whole elements move on every exchange; for wide elements, sorting keys
+// with their indexes as payload and permuting once is usually faster.
+template <class T, class Proj, class = typename std::enable_if<!std::is_same<Proj, bool>::value>::type>
+void bitonic_sort(T* items, std::ptrdiff_t size, Proj proj, bool ascending = true)
+{
+	detail::bitonic_sort(detail::bitonic_projected<T, Proj>{ items, std::move(proj) }, 0, size, ascending);
+}
+
+template <class T>
+void parallel_bitonic_sort(T* items, std::ptrdiff_t size, bool ascending = true)
+{
+	detail::parallel_bitonic_sort(detail::bitonic_items<T>{ items }, 0, size, ascending, detail::bitonic_grain(size));
+}
+
+template <class K, class V>
+void parallel_bitonic_sort(K* keys, V* values, std::ptrdiff_t size, bool ascending = true)
+{
+	detail::parallel_bitonic_sort(detail::bitonic_key_values<K, V>{ keys, values }, 0, size, ascending,
+		detail::bitonic_grain(size));
+}
+
+template <class T, class Proj, class = typename std::enable_if<!std::is_same<Proj, bool>::value>::type>
+void parallel_bitonic_sort(T* items, std::ptrdiff_t size, Proj proj, bool ascending = true)
+{
+	detail::parallel_bitonic_sort(detail::bitonic_projected<T, Proj>{ items, std::move(proj) }, 0, size, ascending,
+		detail::bitonic_grain(size));
+}
+
+} // namespace dx
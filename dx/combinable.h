@@ -0,0 +1,146 @@
+// combinable.h
+// Per-worker copies of a value that are combined at the end of a parallel
+// computation, in the shape of PPL's combinable.
+//
+// Every copy lives in its own cache-line-aligned, cache-line-padded slot,
+// so updates from different workers never share a line. local() finds the
+// slot by the scheduler slot index of the calling thread instead of a
+// hashed thread-local lookup, and combine() folds the slots as a parallel
+// tree, so both cost O(1) per worker.
+#pragma once
+#include "ppl.h"
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace dx {
+
+template <class T>
+class combinable
+{
+	struct alignas(64) slot
+	{
+		std::optional<T> value;
+	};
+
+public:
+	combinable() : combinable([] { return T(); }) {}
+
+	template <class Init>
+	explicit combinable(Init init)
+		: _init(init), _count(scheduler::instance().slot_count()), _slots(new slot[_count])
+	{
+	}
+
+	combinable(const combinable&) = delete;
+	combinable& operator=(const combinable&) = delete;
+
+	// The calling worker's copy; created from the initializer on first use.
+	// External threads that share a scheduler slot over time share one copy,
+	// and combine() includes it.
+	T& local()
+	{
+		bool exists;
+		return local(exists);
+	}
+
+	T& local(bool& exists)
+	{
+		int s = scheduler::instance().current_slot();
+		if (s >= 0 && unsigned(s) < _count)
+		{
+			std::optional<T>& v = _slots[s].value;
+			exists = v.has_value();
+			if (!exists)
+				v.emplace(_init());
+			return *v;
+		}
+		return overflow_local(exists);
+	}
+
+	void clear()
+	{
+		for (unsigned i = 0; i < _count; ++i)
+			_slots[i].value.reset();
+		std::lock_guard<std::mutex> lock(_overflow_mutex);
+		_overflow.clear();
+	}
+
+	// Folds all copies with the associative f, pairwise in parallel.
+	template <class F>
+	T combine(F f) const
+	{
+		std::vector<const T*> values;
+		values.reserve(_count);
+		for (unsigned i = 0; i < _count; ++i)
+		{
+			if (_slots[i].value)
+				values.push_back(&*_slots[i].value);
+		}
+		for (auto& v : _overflow)
+			values.push_back(&v.second);
+		if (values.empty())
+			return _init();
+		return tree_combine(values.data(), values.size(), f);
+	}
+
+	// Calls f on every copy, one at a time.
+	template <class F>
+	void combine_each(F f) const
+	{
+		for (unsigned i = 0; i < _count; ++i)
+		{
+			if (_slots[i].value)
+				f(*_slots[i].value);
+		}
+		for (auto& v : _overflow)
+			f(v.second);
+	}
+
+private:
+	template <class F>
+	static T tree_combine(const T* const* v, std::size_t n, const F& f)
+	{
+		if (n == 1)
+			return *v[0];
+		if (n == 2)
+			return f(*v[0], *v[1]);
+		std::size_t m = n / 2;
+		std::optional<T> left, right;
+		parallel_invoke(
+			[&] { left.emplace(tree_combine(v, m, f)); },
+			[&] { right.emplace(tree_combine(v + m, n - m, f)); });
+		return f(*left, *right);
+	}
+
+	// Threads without a scheduler slot keep their copy in a locked list.
+	T& overflow_local(bool& exists)
+	{
+		std::thread::id id = std::this_thread::get_id();
+		std::lock_guard<std::mutex> lock(_overflow_mutex);
+		for (auto& v : _overflow)
+		{
+			if (v.first == id)
+			{
+				exists = true;
+				return v.second;
+			}
+		}
+		exists = false;
+		_overflow.emplace_back(id, _init());
+		return _overflow.back().second;
+	}
+
+	std::function<T()> _init;
+	const unsigned _count;
+	std::unique_ptr<slot[]> _slots;
+	mutable std::list<std::pair<std::thread::id, T>> _overflow;
+	std::mutex _overflow_mutex;
+};
+
+} // namespace dx
@@ -0,0 +1,158 @@
+// concurrent_vector.h
+// Grow-only vector that supports concurrent push_back, in the shape of
+// <concurrent_vector.h>. Elements never move once constructed.
+//
+// Storage is a table of segments whose sizes double: segment k holds
+// first_block << k elements, so an index maps to its segment with one
+// bit scan and no segment is ever reallocated.
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <utility>
+
+namespace dx {
+
+template <class T>
+class concurrent_vector
+{
+	static const std::size_t first_block_log = 3;
+	static const std::size_t first_block = std::size_t(1) << first_block_log;
+	static const std::size_t segment_count = sizeof(std::size_t) * 8 - first_block_log;
+
+	template <class V, class Owner>
+	class basic_iterator
+	{
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef V value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef V* pointer;
+		typedef V& reference;
+
+		basic_iterator() : _v(nullptr), _i(0) {}
+		basic_iterator(Owner* v, std::size_t i) : _v(v), _i(i) {}
+
+		reference operator*() const { return (*_v)[_i]; }
+		pointer operator->() const { return &(*_v)[_i]; }
+		reference operator[](difference_type k) const { return (*_v)[_i + k]; }
+
+		basic_iterator& operator++() { ++_i; return *this; }
+		basic_iterator operator++(int) { basic_iterator t = *this; ++_i; return t; }
+		basic_iterator& operator--() { --_i; return *this; }
+		basic_iterator operator--(int) { basic_iterator t = *this; --_i; return t; }
+		basic_iterator& operator+=(difference_type k) { _i += k; return *this; }
+		basic_iterator& operator-=(difference_type k) { _i -= k; return *this; }
+		basic_iterator operator+(difference_type k) const { return basic_iterator(_v, _i + k); }
+		basic_iterator operator-(difference_type k) const { return basic_iterator(_v, _i - k); }
+		difference_type operator-(const basic_iterator& o) const { return difference_type(_i) - difference_type(o._i); }
+
+		bool operator==(const basic_iterator& o) const { return _i == o._i; }
+		bool operator!=(const basic_iterator& o) const { return _i != o._i; }
+		bool operator<(const basic_iterator& o) const { return _i < o._i; }
+		bool operator>(const basic_iterator& o) const { return _i > o._i; }
+		bool operator<=(const basic_iterator& o) const { return _i <= o._i; }
+		bool operator>=(const basic_iterator& o) const { return _i >= o._i; }
+
+	private:
+		Owner* _v;
+		std::size_t _i;
+	};
+
+public:
+	typedef T value_type;
+	typedef std::size_t size_type;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef basic_iterator<T, concurrent_vector> iterator;
+	typedef basic_iterator<const T, const concurrent_vector> const_iterator;
+
+	concurrent_vector() : _size(0)
+	{
+		for (auto& s : _segments)
+			s.store(nullptr, std::memory_order_relaxed);
+	}
+
+	~concurrent_vector() { clear(); }
+
+	concurrent_vector(const concurrent_vector&) = delete;
+	concurrent_vector& operator=(const concurrent_vector&) = delete;
+
+	// Safe to call from many threads at once.
+	iterator push_back(const T& x) { return emplace(x); }
+	iterator push_back(T&& x) { return emplace(std::move(x)); }
+
+	size_type size() const { return _size.load(std::memory_order_acquire); }
+	bool empty() const { return size() == 0; }
+
+	reference operator[](size_type i)
+	{
+		std::size_t k, off;
+		locate(i, k, off);
+		return _segments[k].load(std::memory_order_relaxed)[off];
+	}
+
+	const_reference operator[](size_type i) const
+	{
+		std::size_t k, off;
+		locate(i, k, off);
+		return _segments[k].load(std::memory_order_relaxed)[off];
+	}
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, size()); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, size()); }
+
+	// Not safe to call concurrently with anything else.
+	void clear()
+	{
+		std::size_t n = _size.exchange(0);
+		for (std::size_t i = 0; i < n; ++i)
+			(*this)[i].~T();
+		for (auto& s : _segments)
+			::operator delete(s.exchange(nullptr));
+	}
+
+private:
+	static void locate(std::size_t i, std::size_t& k, std::size_t& off)
+	{
+		std::size_t j = i + first_block;
+		std::size_t b = 0;
+		while ((j >> (b + 1)) != 0)
+			++b;
+		k = b - first_block_log;
+		off = j - (std::size_t(1) << b);
+	}
+
+	T* segment(std::size_t k)
+	{
+		T* s = _segments[k].load(std::memory_order_acquire);
+		if (s)
+			return s;
+		T* fresh = static_cast<T*>(::operator new((first_block << k) * sizeof(T)));
+		if (_segments[k].compare_exchange_strong(s, fresh,
+			std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			return fresh;
+		}
+		::operator delete(fresh);
+		return s;
+	}
+
+	template <class U>
+	iterator emplace(U&& x)
+	{
+		std::size_t i = _size.fetch_add(1, std::memory_order_acq_rel);
+		std::size_t k, off;
+		locate(i, k, off);
+		new (segment(k) + off) T(std::forward<U>(x));
+		return iterator(this, i);
+	}
+
+	std::atomic<T*> _segments[segment_count];
+	std::atomic<std::size_t> _size;
+};
+
+} // namespace dx
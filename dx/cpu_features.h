@@ -0,0 +1,90 @@
+// cpu_features.h
+// Runtime detection of the vector instruction sets that the SIMD kernels
+// are compiled for, so one binary runs the widest kernel the CPU and OS
+// support.
+//
+// Kernels are compiled with DX_TARGET_AVX2 / DX_TARGET_AVX512 instead of
+// global -mavx flags and are only called after cpu_simd_level() said so.
+// The DX_SIMD environment variable (none, avx2, avx512) caps the level,
+// for comparing kernels on one machine.
+#pragma once
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DX_X86_SIMD 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+#if defined(DX_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define DX_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define DX_TARGET_AVX512 __attribute__((target("avx512f,avx512vl,avx512bw,avx512dq,avx2,popcnt")))
+#else
+#define DX_TARGET_AVX2
+#define DX_TARGET_AVX512
+#endif
+
+namespace dx {
+
+enum class simd_level
+{
+	none,
+	avx2,
+	avx512
+};
+
+namespace detail {
+
+inline simd_level detect_simd_level()
+{
+#if !defined(DX_X86_SIMD)
+	return simd_level::none;
+#elif defined(_MSC_VER) && !defined(__clang__)
+	int r[4];
+	__cpuid(r, 1);
+	const bool osxsave = (r[2] & (1 << 27)) != 0, avx = (r[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return simd_level::none;
+	const unsigned long long xcr0 = _xgetbv(0);
+	if ((xcr0 & 0x6) != 0x6)
+		return simd_level::none;
+	__cpuidex(r, 7, 0);
+	const bool avx2 = (r[1] & (1 << 5)) != 0;
+	const bool avx512 = (r[1] & (1 << 16)) && (r[1] & (1 << 17)) && (r[1] & (1 << 30)) && (r[1] & (1u << 31));
+	if (avx512 && (xcr0 & 0xe6) == 0xe6)
+		return simd_level::avx512;
+	return avx2 ? simd_level::avx2 : simd_level::none;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")
+		&& __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq"))
+		return simd_level::avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return simd_level::avx2;
+	return simd_level::none;
+#endif
+}
+
+} // namespace detail
+
+// Widest instruction set the kernels may use on this machine.
+inline simd_level cpu_simd_level()
+{
+	static const simd_level level = [] {
+		simd_level l = detail::detect_simd_level();
+		if (const char* cap = std::getenv("DX_SIMD"))
+		{
+			if (std::strcmp(cap, "none") == 0)
+				l = simd_level::none;
+			else if (std::strcmp(cap, "avx2") == 0 && l == simd_level::avx512)
+				l = simd_level::avx2;
+		}
+		return l;
+	}();
+	return level;
+}
+
+} // namespace dx
@@ -0,0 +1,364 @@
+// csr_graph.h
+// Undirected graph in compressed sparse row form, updated in batches.
+//
+// A csr_snapshot is one immutable version of the graph: the neighbours of
+// all nodes in one array, those of node u at [offset[u], offset[u + 1]),
+// sorted, with 32-bit node ids and offsets. Walking a node's neighbours is
+// a scan of contiguous memory, and an edge test is a binary search. A
+// snapshot shares its arrays with every copy and stays valid while the
+// graph moves on, so traversals read it without locks.
+//
+// csr_graph stages insertions and deletions as a delta batch, from any
+// number of threads: every worker appends to its own buffer, under a lock
+// that only commit() ever contends, and insert_edges/erase_edges stage a
+// whole range under one lock. commit() concatenates the buffers, merges
+// them into a new version and publishes it: the changes are bucketed by
+// node in two linear passes, then in parallel every node sorts its
+// changes, keeps the last one of each edge and counts its new degree by
+// merging them with its sorted row; a scan of the degrees gives the
+// offsets, and a second parallel merge fills the rows. A batch costs about
+// one pass over the graph however many edges it changes, where changing
+// the rows of a vector<vector<int>> one edge at a time costs a search and
+// an erase from the middle each. Which of two changes of one edge staged
+// by different threads since the last commit wins is unspecified.
+//
+// Inserting an edge to a node id beyond the graph grows it to that node,
+// as add_edge grows an adjacency list. Edges number below 2^31.
+#pragma once
+#include "ppl.h"
+#include "combinable.h"
+#include "scan.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace dx {
+
+// The neighbours of one node of a snapshot, in ascending order.
+class csr_neighbours
+{
+public:
+	typedef const std::uint32_t* iterator;
+
+	csr_neighbours(iterator first, iterator last) : _first(first), _last(last) {}
+
+	iterator begin() const { return _first; }
+	iterator end() const { return _last; }
+	std::size_t size() const { return std::size_t(_last - _first); }
+	bool empty() const { return _first == _last; }
+	std::uint32_t operator[](std::size_t i) const { return _first[i]; }
+
+private:
+	iterator _first;
+	iterator _last;
+};
+
+class csr_snapshot
+{
+public:
+	csr_snapshot() : _data(std::make_shared<data>()) {}
+
+	// Number of nodes.
+	std::size_t size() const { return _data->offset.size() - 1; }
+
+	// Number of undirected edges.
+	std::size_t edges() const { return _data->target.size() / 2; }
+
+	csr_neighbours operator[](std::size_t u) const
+	{
+		const std::uint32_t* t = _data->target.data();
+		return csr_neighbours(t + _data->offset[u], t + _data->offset[u + 1]);
+	}
+
+	bool contains(std::uint32_t a, std::uint32_t b) const
+	{
+		if (a >= size())
+			return false;
+		const csr_neighbours row = (*this)[a];
+		return std::binary_search(row.begin(), row.end(), b);
+	}
+
+private:
+	friend class csr_graph;
+
+	struct data
+	{
+		data() : offset(1, 0) {}
+
+		std::vector<std::uint32_t> offset;
+		std::vector<std::uint32_t> target;
+	};
+
+	explicit csr_snapshot(std::shared_ptr<const data> d) : _data(std::move(d)) {}
+
+	std::shared_ptr<const data> _data;
+};
+
+namespace detail {
+
+// One staged change of the directed entry u -> v.
+struct edge_delta
+{
+	std::uint32_t u;
+	std::uint32_t v;
+	bool insert;
+};
+
+// A change of the row of one node, seq its place in the batch.
+struct edge_change
+{
+	std::uint32_t v;
+	std::uint32_t seq;
+	bool insert;
+};
+
+// Walks the sorted row of a node together with its sorted changes and
+// calls out(v) for every neighbour it has after them.
+template <class Out>
+void merge_row(const std::uint32_t* row, const std::uint32_t* row_end, const edge_change* d, const edge_change* d_end,
+	const Out& out)
+{
+	while (row != row_end || d != d_end)
+	{
+		if (d == d_end || (row != row_end && *row < d->v))
+		{
+			out(*row++);
+		}
+		else
+		{
+			if (row != row_end && *row == d->v)
+				++row;
+			if (d->insert)
+				out(d->v);
+			++d;
+		}
+	}
+}
+
+} // namespace detail
+
+class csr_graph
+{
+public:
+	csr_graph()
+		: _staged([] { return std::unique_ptr<stage_buffer>(new stage_buffer()); }),
+		_current(std::make_shared<csr_snapshot::data>())
+	{
+	}
+
+	explicit csr_graph(std::size_t nodes) : csr_graph()
+	{
+		std::shared_ptr<csr_snapshot::data> d = std::make_shared<csr_snapshot::data>();
+		d->offset.assign(nodes + 1, 0);
+		_current = std::move(d);
+	}
+
+	csr_graph(const csr_graph&) = delete;
+	csr_graph& operator=(const csr_graph&) = delete;
+
+	// Stages the edge a - b; a self loop is ignored.
+	void insert_edge(std::uint32_t a, std::uint32_t b)
+	{
+		const std::pair<std::uint32_t, std::uint32_t> e(a, b);
+		stage(&e, &e + 1, true);
+	}
+
+	// Stages the removal of the edge a - b.
+	void erase_edge(std::uint32_t a, std::uint32_t b)
+	{
+		const std::pair<std::uint32_t, std::uint32_t> e(a, b);
+		stage(&e, &e + 1, false);
+	}
+
+	// Stages the edges of [first, last), pairs (a, b) like
+	// std::pair<uint32_t, uint32_t>.
+	template <class It>
+	void insert_edges(It first, It last)
+	{
+		stage(first, last, true);
+	}
+
+	// Stages the removal of the edges of [first, last).
+	template <class It>
+	void erase_edges(It first, It last)
+	{
+		stage(first, last, false);
+	}
+
+	// Number of staged changes of directed entries.
+	std::size_t pending() const
+	{
+		std::size_t n = 0;
+		_staged.combine_each([&n](const std::unique_ptr<stage_buffer>& b) {
+			std::lock_guard<std::mutex> lock(b->mutex);
+			n += b->deltas.size();
+		});
+		return n;
+	}
+
+	// The latest committed version.
+	csr_snapshot snapshot() const
+	{
+		std::lock_guard<std::mutex> lock(_current_mutex);
+		return csr_snapshot(_current);
+	}
+
+	// Merges the staged changes into a new version, publishes it and
+	// returns it. Changes staged while it runs go into the next commit.
+	csr_snapshot commit()
+	{
+		std::lock_guard<std::mutex> commit_lock(_commit_mutex);
+		// The batch is the buffers one after the other.
+		std::vector<std::vector<detail::edge_delta>> batch;
+		std::size_t total = 0;
+		_staged.combine_each([&](const std::unique_ptr<stage_buffer>& b) {
+			batch.emplace_back();
+			std::lock_guard<std::mutex> lock(b->mutex);
+			batch.back().swap(b->deltas);
+			total += batch.back().size();
+		});
+		const csr_snapshot old = snapshot();
+		if (total == 0)
+			return old;
+		std::shared_ptr<const csr_snapshot::data> next = merge(*old._data, batch);
+		{
+			std::lock_guard<std::mutex> lock(_current_mutex);
+			_current = next;
+		}
+		return csr_snapshot(std::move(next));
+	}
+
+private:
+	// Changes staged by one worker. Only commit() takes its lock from
+	// another thread.
+	struct stage_buffer
+	{
+		std::mutex mutex;
+		std::vector<detail::edge_delta> deltas;
+	};
+
+	template <class It>
+	void stage(It first, It last, bool insert)
+	{
+		stage_buffer& b = *_staged.local();
+		std::lock_guard<std::mutex> lock(b.mutex);
+		for (; first != last; ++first)
+		{
+			const std::uint32_t a = std::uint32_t(first->first), v = std::uint32_t(first->second);
+			if (a == v)
+				continue;
+			b.deltas.push_back(detail::edge_delta{ a, v, insert });
+			b.deltas.push_back(detail::edge_delta{ v, a, insert });
+		}
+	}
+
+	static std::shared_ptr<const csr_snapshot::data> merge(const csr_snapshot::data& old,
+		const std::vector<std::vector<detail::edge_delta>>& batch)
+	{
+		typedef detail::edge_change edge_change;
+		// Every insertion grows the graph, even one erased again later;
+		// a change of a node beyond it erases nothing.
+		const std::size_t old_nodes = old.offset.size() - 1;
+		std::size_t nodes = old_nodes;
+		for (const std::vector<detail::edge_delta>& part : batch)
+		{
+			for (const detail::edge_delta& e : part)
+			{
+				if (e.insert)
+					nodes = (std::max)(nodes, std::size_t(e.u) + 1);
+			}
+		}
+
+		// The changes bucketed by node: change[bucket[u], bucket[u + 1]).
+		std::vector<std::uint32_t> bucket(nodes + 1, 0);
+		for (const std::vector<detail::edge_delta>& part : batch)
+		{
+			for (const detail::edge_delta& e : part)
+			{
+				if (e.u < nodes)
+					++bucket[e.u];
+			}
+		}
+		parallel_exclusive_scan(bucket.begin(), bucket.end(), bucket.begin(), std::uint32_t(0));
+		std::vector<edge_change> change(bucket[nodes]);
+		{
+			std::vector<std::uint32_t> at(bucket.begin(), bucket.end() - 1);
+			std::uint32_t seq = 0;
+			for (const std::vector<detail::edge_delta>& part : batch)
+			{
+				for (const detail::edge_delta& e : part)
+				{
+					if (e.u < nodes)
+						change[at[e.u]++] = edge_change{ e.v, seq, e.insert };
+					++seq;
+				}
+			}
+		}
+
+		auto row = [&](std::size_t u, const std::uint32_t*& first, const std::uint32_t*& last) {
+			first = last = old.target.data();
+			if (u < old_nodes)
+			{
+				first += old.offset[u];
+				last += old.offset[u + 1];
+			}
+		};
+
+		// Per node: its changes sorted by neighbour, only the last staged
+		// one of each kept (up to change_end[u]), then its new degree.
+		std::shared_ptr<csr_snapshot::data> next = std::make_shared<csr_snapshot::data>();
+		std::vector<std::uint32_t>& offset = next->offset;
+		offset.assign(nodes + 1, 0);
+		std::vector<std::uint32_t> change_end(nodes);
+		detail::for_range(0, nodes, detail::auto_grain(nodes), [&](std::size_t lo, std::size_t hi) {
+			for (std::size_t u = lo; u < hi; ++u)
+			{
+				edge_change* c = change.data() + bucket[u];
+				edge_change* c_end = change.data() + bucket[u + 1];
+				std::sort(c, c_end, [](const edge_change& x, const edge_change& y) {
+					return x.v != y.v ? x.v < y.v : x.seq < y.seq;
+				});
+				edge_change* kept = c;
+				for (edge_change* i = c; i != c_end; ++i)
+				{
+					if (i + 1 == c_end || i[1].v != i->v)
+						*kept++ = *i;
+				}
+				change_end[u] = std::uint32_t(kept - change.data());
+				const std::uint32_t* first;
+				const std::uint32_t* last;
+				row(u, first, last);
+				std::uint32_t degree = 0;
+				detail::merge_row(first, last, c, kept, [&degree](std::uint32_t) { ++degree; });
+				offset[u] = degree;
+			}
+		});
+		parallel_exclusive_scan(offset.begin(), offset.end(), offset.begin(), std::uint32_t(0));
+
+		next->target.resize(offset[nodes]);
+		std::uint32_t* target = next->target.data();
+		detail::for_range(0, nodes, detail::auto_grain(nodes), [&](std::size_t lo, std::size_t hi) {
+			for (std::size_t u = lo; u < hi; ++u)
+			{
+				const std::uint32_t* first;
+				const std::uint32_t* last;
+				row(u, first, last);
+				std::uint32_t* out = target + offset[u];
+				detail::merge_row(first, last, change.data() + bucket[u], change.data() + change_end[u],
+					[&out](std::uint32_t v) { *out++ = v; });
+			}
+		});
+		return next;
+	}
+
+	combinable<std::unique_ptr<stage_buffer>> _staged;
+	mutable std::mutex _current_mutex;
+	std::shared_ptr<const csr_snapshot::data> _current;
+	std::mutex _commit_mutex;
+};
+
+} // namespace dx
@@ -0,0 +1,340 @@
+// find.h
+// Short-circuiting parallel searches: parallel_find_first/_last/_any,
+// parallel_any_of/_all_of/_none_of, parallel_count_if, parallel_mismatch
+// and parallel_find_end.
+//
+// All of them run on one cooperative-cancellation mechanism, search.
+// Workers claim chunks of the range from a shared cursor that only moves
+// right, so chunks start in left-to-right order. Chunks start small, so
+// an early match is found before much of the range has been handed out.
+// They grow with the cursor to amortize the claims. The only shared state
+// is a bound, a relaxed atomic index: work at or right of it is given up.
+// It is read before every block of a few hundred elements, never per
+// element. A leftmost search lowers the bound to each match with an atomic
+// min, so everything left of the best match is still searched and the
+// result is the one std::find_if gives, while the search ends about as
+// soon as one that stops at any match. An unordered search (any_of,
+// find_any) drops the bound to 0 and every worker stops after its current
+// block. A search inside run_with_cancellation_token also stops once the
+// token is canceled.
+//
+// find_last and find_end search the reversed range the same way.
+#pragma once
+#include "ppl.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+namespace dx {
+
+namespace detail {
+
+// Hands out [0, n) as consecutive chunks, left to right, to any number of
+// workers. A chunk is an eighth of the distance already handed out, kept
+// between min_chunk and max_chunk.
+class chunk_cursor
+{
+public:
+	static const std::size_t min_chunk = 256;
+	static const std::size_t max_chunk = 64 * 1024;
+
+	explicit chunk_cursor(std::size_t n) : _next(0), _n(n) {}
+
+	bool claim(std::size_t& lo, std::size_t& hi)
+	{
+		std::size_t cur = _next.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			if (cur >= _n)
+				return false;
+			const std::size_t len = (std::min)(max_chunk, (std::max)(min_chunk, cur / 8));
+			const std::size_t end = (std::min)(_n, cur + len);
+			if (_next.compare_exchange_weak(cur, end, std::memory_order_relaxed))
+			{
+				lo = cur;
+				hi = end;
+				return true;
+			}
+		}
+	}
+
+private:
+	std::atomic<std::size_t> _next;
+	std::size_t _n;
+};
+
+// Lowers best to i unless it is already lower.
+inline void atomic_min(std::atomic<std::size_t>& best, std::size_t i)
+{
+	std::size_t cur = best.load(std::memory_order_relaxed);
+	while (i < cur && !best.compare_exchange_weak(cur, i, std::memory_order_relaxed))
+	{
+	}
+}
+
+// One search over [0, n): the chunk cursor and the bound.
+class search
+{
+public:
+	// Elements between two reads of the bound.
+	static const std::size_t block_size = 256;
+
+	explicit search(std::size_t n) : _cursor(n), _bound(n) {}
+
+	// Calls scan(lo, hi) on consecutive blocks of every chunk, on all
+	// workers, until the range is used up or the bound is at or left of
+	// the next block. scan returns false to give up the rest of its chunk.
+	template <class Scan>
+	void run(const Scan& scan)
+	{
+		const std::atomic<bool>* cancel = current_cancel_flag();
+		parallel_for(std::size_t(0), std::size_t(scheduler::instance().concurrency()), [&](std::size_t) {
+			std::size_t lo, hi;
+			while (!canceled(cancel) && _cursor.claim(lo, hi) && lo < bound())
+			{
+				for (std::size_t i = lo; i < hi && i < bound(); i += block_size)
+				{
+					if (!scan(i, (std::min)(hi, i + block_size)))
+						break;
+				}
+			}
+		});
+	}
+
+	std::size_t bound() const { return _bound.load(std::memory_order_relaxed); }
+
+	// A match at i: nothing right of it is needed any more.
+	void found(std::size_t i) { atomic_min(_bound, i); }
+
+	// Gives up the whole search.
+	void stop() { _bound.store(0, std::memory_order_relaxed); }
+
+private:
+	static bool canceled(const std::atomic<bool>* cancel)
+	{
+		return cancel && cancel->load(std::memory_order_relaxed);
+	}
+
+	chunk_cursor _cursor;
+	std::atomic<std::size_t> _bound;
+};
+
+// Whether a range of n elements is worth searching in parallel.
+inline bool parallel_search_pays(std::size_t n)
+{
+	return scheduler::instance().concurrency() > 1 && n > chunk_cursor::min_chunk;
+}
+
+// Offset of the first i in [0, n) with hit(i), or n.
+template <class Hit>
+std::size_t find_first_index(std::size_t n, const Hit& hit)
+{
+	search s(n);
+	s.run([&](std::size_t lo, std::size_t hi) {
+		for (std::size_t i = lo; i < hi; ++i)
+		{
+			if (hit(i))
+			{
+				s.found(i);
+				return false;
+			}
+		}
+		return true;
+	});
+	return s.bound();
+}
+
+// Offset of some i in [0, n) with hit(i), or n.
+template <class Hit>
+std::size_t find_any_index(std::size_t n, const Hit& hit)
+{
+	std::atomic<std::size_t> any(n);
+	search s(n);
+	s.run([&](std::size_t lo, std::size_t hi) {
+		for (std::size_t i = lo; i < hi; ++i)
+		{
+			if (hit(i))
+			{
+				std::size_t none = n;
+				any.compare_exchange_strong(none, i, std::memory_order_relaxed);
+				s.stop();
+				return false;
+			}
+		}
+		return true;
+	});
+	return any.load(std::memory_order_relaxed);
+}
+
+} // namespace detail
+
+// The first element of [first, last) that satisfies pred, or last.
+template <class It, class Pred>
+It parallel_find_first(It first, It last, const Pred& pred)
+{
+	if constexpr (!detail::is_random_access<It>::value)
+	{
+		return std::find_if(first, last, pred);
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		if (!detail::parallel_search_pays(n))
+			return std::find_if(first, last, pred);
+		return std::next(first, detail::find_first_index(n, [&](std::size_t i) { return bool(pred(first[i])); }));
+	}
+}
+
+// The last element of [first, last) that satisfies pred, or last.
+template <class It, class Pred>
+It parallel_find_last(It first, It last, const Pred& pred)
+{
+	if constexpr (!detail::is_random_access<It>::value)
+	{
+		It found = last;
+		for (; first != last; ++first)
+		{
+			if (pred(*first))
+				found = first;
+		}
+		return found;
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		std::size_t k;
+		if (!detail::parallel_search_pays(n))
+		{
+			const std::reverse_iterator<It> r = std::find_if(std::reverse_iterator<It>(last),
+				std::reverse_iterator<It>(first), pred);
+			k = std::size_t(std::distance(std::reverse_iterator<It>(last), r));
+		}
+		else
+		{
+			k = detail::find_first_index(n, [&](std::size_t j) { return bool(pred(first[n - 1 - j])); });
+		}
+		return k == n ? last : std::next(first, n - 1 - k);
+	}
+}
+
+// Some element of [first, last) that satisfies pred, or last: whichever
+// match a worker reaches first.
+template <class It, class Pred>
+It parallel_find_any(It first, It last, const Pred& pred)
+{
+	if constexpr (!detail::is_random_access<It>::value)
+	{
+		return std::find_if(first, last, pred);
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		if (!detail::parallel_search_pays(n))
+			return std::find_if(first, last, pred);
+		return std::next(first, detail::find_any_index(n, [&](std::size_t i) { return bool(pred(first[i])); }));
+	}
+}
+
+template <class It, class Pred>
+bool parallel_any_of(It first, It last, const Pred& pred)
+{
+	return parallel_find_any(first, last, pred) != last;
+}
+
+template <class It, class Pred>
+bool parallel_none_of(It first, It last, const Pred& pred)
+{
+	return parallel_find_any(first, last, pred) == last;
+}
+
+template <class It, class Pred>
+bool parallel_all_of(It first, It last, const Pred& pred)
+{
+	return parallel_find_any(first, last, [&pred](const auto& v) { return !pred(v); }) == last;
+}
+
+// Number of elements of [first, last) that satisfy pred. It never stops
+// early, but shares the chunking of the searches.
+template <class It, class Pred>
+typename std::iterator_traits<It>::difference_type parallel_count_if(It first, It last, const Pred& pred)
+{
+	typedef typename std::iterator_traits<It>::difference_type D;
+	if constexpr (!detail::is_random_access<It>::value)
+	{
+		return std::count_if(first, last, pred);
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		if (!detail::parallel_search_pays(n))
+			return std::count_if(first, last, pred);
+		combinable<D> count;
+		detail::search s(n);
+		s.run([&](std::size_t lo, std::size_t hi) {
+			count.local() += std::count_if(std::next(first, lo), std::next(first, hi), pred);
+			return true;
+		});
+		return count.combine(std::plus<D>());
+	}
+}
+
+// The first position where the ranges differ by pred (equality by
+// default), as std::mismatch returns it. [first2, ...) is at least as long
+// as [first1, last1).
+template <class It1, class It2, class Pred>
+std::pair<It1, It2> parallel_mismatch(It1 first1, It1 last1, It2 first2, const Pred& pred)
+{
+	if constexpr (!detail::is_random_access<It1>::value || !detail::is_random_access<It2>::value)
+	{
+		return std::mismatch(first1, last1, first2, pred);
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first1, last1));
+		if (!detail::parallel_search_pays(n))
+			return std::mismatch(first1, last1, first2, pred);
+		const std::size_t k = detail::find_first_index(n, [&](std::size_t i) { return !pred(first1[i], first2[i]); });
+		return std::make_pair(std::next(first1, k), std::next(first2, k));
+	}
+}
+
+template <class It1, class It2>
+std::pair<It1, It2> parallel_mismatch(It1 first1, It1 last1, It2 first2)
+{
+	return parallel_mismatch(first1, last1, first2, std::equal_to<>());
+}
+
+// The start of the last occurrence of [s_first, s_last) in [first, last),
+// or last, as std::find_end returns it.
+template <class It1, class It2, class Pred>
+It1 parallel_find_end(It1 first, It1 last, It2 s_first, It2 s_last, const Pred& pred)
+{
+	if constexpr (!detail::is_random_access<It1>::value || !detail::is_random_access<It2>::value)
+	{
+		return std::find_end(first, last, s_first, s_last, pred);
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		const std::size_t m = std::size_t(std::distance(s_first, s_last));
+		if (m == 0 || m > n || !detail::parallel_search_pays(n - m + 1))
+			return std::find_end(first, last, s_first, s_last, pred);
+		// Starts, from the right.
+		const std::size_t starts = n - m + 1;
+		const std::size_t k = detail::find_first_index(starts, [&](std::size_t j) {
+			return std::equal(std::next(first, starts - 1 - j), std::next(first, starts - 1 - j + m), s_first, pred);
+		});
+		return k == starts ? last : std::next(first, starts - 1 - k);
+	}
+}
+
+template <class It1, class It2>
+It1 parallel_find_end(It1 first, It1 last, It2 s_first, It2 s_last)
+{
+	return parallel_find_end(first, last, s_first, s_last, std::equal_to<>());
+}
+
+} // namespace dx
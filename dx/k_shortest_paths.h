@@ -0,0 +1,222 @@
+// k_shortest_paths.h
+// k shortest simple paths between two nodes of an unweighted graph, by
+// Yen's algorithm with Lawler's restriction on spur nodes.
+//
+// The first path is a shortest path. Every following one is the shortest
+// of the candidates, and each new path adds candidates: for a spur node at
+// position i of it, the path's first i nodes (the root) are blocked, and
+// so are the edges out of the spur node taken by any path found so far
+// that shares the root; a shortest spur path to the target then completes
+// root + spur into a candidate. Spur nodes before the position where a
+// path left its parent give nothing new (Lawler), so only the ones from
+// there on are tried, and those spur searches run in parallel.
+//
+// A spur search is an A* search guided by the hop distance to the target
+// in the whole graph, computed once by a breadth-first search; blocking
+// only makes distances longer, so the guide never overestimates. With it a
+// search mostly walks straight down a shortest path instead of flooding
+// the graph. Each worker keeps its search arrays and bucket queue across
+// searches and invalidates the arrays with a stamp instead of clearing
+// them.
+//
+// A graph is anything with size() nodes numbered from 0 whose g[u] is a
+// range of the neighbours of u, such as vector<vector<int>>; edges go both
+// ways, v in g[u] exactly when u in g[v]. The length of a path is its
+// number of edges.
+#pragma once
+#include "ppl.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace dx {
+
+namespace detail {
+
+// Hop distances from node from, -1 where unreachable.
+template <class Graph>
+std::vector<int> hop_distances(const Graph& g, int from)
+{
+	std::vector<int> dist(g.size(), -1);
+	std::vector<int> frontier(1, from), next;
+	dist[std::size_t(from)] = 0;
+	for (int d = 1; !frontier.empty(); ++d)
+	{
+		next.clear();
+		for (int u : frontier)
+		{
+			for (int v : g[std::size_t(u)])
+			{
+				if (dist[std::size_t(v)] < 0)
+				{
+					dist[std::size_t(v)] = d;
+					next.push_back(v);
+				}
+			}
+		}
+		frontier.swap(next);
+	}
+	return dist;
+}
+
+// Per-worker arrays of the spur searches. An entry is valid only while its
+// stamp equals the current one, so starting a search costs nothing.
+struct spur_scratch
+{
+	std::vector<std::uint32_t> reached;
+	std::vector<std::uint32_t> blocked;
+	std::vector<int> dist;
+	std::vector<int> parent;
+	// Open nodes with their distance, by f - f of the spur node.
+	std::vector<std::vector<std::pair<int, int>>> open;
+	std::uint32_t stamp = 0;
+
+	void begin(std::size_t n)
+	{
+		if (reached.size() != n || ++stamp == 0)
+		{
+			reached.assign(n, 0);
+			blocked.assign(n, 0);
+			dist.resize(n);
+			parent.resize(n);
+			stamp = 1;
+		}
+	}
+};
+
+// Shortest path from spur to target that avoids the blocked nodes of s
+// and the edges from spur to the nodes of banned, appended to out
+// (without spur). h is the hop distance to the target.
+//
+// f = g + h never decreases along the search and is a small integer, so
+// the open set is a bucket per f, each a stack: the deepest node of the
+// lowest f comes first, which keeps the search on one of the many
+// shortest paths of a grid.
+template <class Graph>
+bool spur_path(const Graph& g, const std::vector<int>& h, int spur, int target, const std::vector<int>& banned,
+	spur_scratch& s, std::vector<int>& out)
+{
+	const std::uint32_t stamp = s.stamp;
+	const int f0 = h[std::size_t(spur)];
+	s.reached[std::size_t(spur)] = stamp;
+	s.dist[std::size_t(spur)] = 0;
+	s.parent[std::size_t(spur)] = -1;
+	for (std::vector<std::pair<int, int>>& b : s.open)
+		b.clear();
+	if (s.open.empty())
+		s.open.resize(1);
+	s.open[0].push_back(std::make_pair(spur, 0));
+	for (std::size_t f = 0; f < s.open.size(); ++f)
+	{
+		while (!s.open[f].empty())
+		{
+			const int u = s.open[f].back().first, gu = s.open[f].back().second;
+			s.open[f].pop_back();
+			if (gu != s.dist[std::size_t(u)])
+				continue;
+			if (u == target)
+			{
+				const std::size_t at = out.size();
+				for (int v = u; v != spur; v = s.parent[std::size_t(v)])
+					out.push_back(v);
+				std::reverse(out.begin() + std::ptrdiff_t(at), out.end());
+				return true;
+			}
+			for (int v : g[std::size_t(u)])
+			{
+				const std::size_t vi = std::size_t(v);
+				if (s.blocked[vi] == stamp || h[vi] < 0)
+					continue;
+				if (u == spur && std::find(banned.begin(), banned.end(), v) != banned.end())
+					continue;
+				if (s.reached[vi] != stamp || gu + 1 < s.dist[vi])
+				{
+					s.reached[vi] = stamp;
+					s.dist[vi] = gu + 1;
+					s.parent[vi] = u;
+					const std::size_t fv = std::size_t(gu + 1 + h[vi] - f0);
+					if (fv >= s.open.size())
+						s.open.resize(fv + 1);
+					s.open[fv].push_back(std::make_pair(v, gu + 1));
+				}
+			}
+		}
+	}
+	return false;
+}
+
+} // namespace detail
+
+// Up to k shortest simple paths from source to target, shortest first,
+// each as its nodes from source to target.
+template <class Graph>
+std::vector<std::vector<int>> k_shortest_simple_paths(const Graph& g, int source, int target, std::size_t k)
+{
+	std::vector<std::vector<int>> found;
+	if (k == 0 || source < 0 || target < 0 || std::size_t(source) >= g.size() || std::size_t(target) >= g.size())
+		return found;
+	const std::vector<int> h = detail::hop_distances(g, target);
+	if (h[std::size_t(source)] < 0)
+		return found;
+
+	combinable<detail::spur_scratch> scratch;
+	std::vector<int> first(1, source);
+	{
+		detail::spur_scratch& s = scratch.local();
+		s.begin(g.size());
+		detail::spur_path(g, h, source, target, std::vector<int>(), s, first);
+	}
+
+	// Candidates by length, then by nodes, each with the position where it
+	// left the path it was found from.
+	struct shorter
+	{
+		bool operator()(const std::vector<int>& a, const std::vector<int>& b) const
+		{
+			return a.size() != b.size() ? a.size() < b.size() : a < b;
+		}
+	};
+	std::map<std::vector<int>, std::size_t, shorter> candidates;
+	std::vector<std::size_t> deviation(1, 0);
+	found.push_back(std::move(first));
+	while (found.size() < k)
+	{
+		const std::vector<int>& last = found.back();
+		const std::size_t from = deviation.back();
+		const std::size_t count = last.size() - 1 - from;
+		std::vector<std::vector<int>> spur(count);
+		parallel_for(std::size_t(0), count, [&](std::size_t j) {
+			const std::size_t i = from + j;
+			detail::spur_scratch& s = scratch.local();
+			s.begin(g.size());
+			for (std::size_t r = 0; r < i; ++r)
+				s.blocked[std::size_t(last[r])] = s.stamp;
+			std::vector<int> banned;
+			for (const std::vector<int>& p : found)
+			{
+				if (p.size() > i + 1 && std::equal(last.begin(), last.begin() + std::ptrdiff_t(i + 1), p.begin()))
+					banned.push_back(p[i + 1]);
+			}
+			std::vector<int> path(last.begin(), last.begin() + std::ptrdiff_t(i + 1));
+			if (detail::spur_path(g, h, last[i], target, banned, s, path))
+				spur[j] = std::move(path);
+		});
+		// The same path from two spur nodes keeps the first.
+		for (std::size_t j = 0; j < count; ++j)
+		{
+			if (!spur[j].empty())
+				candidates.emplace(std::move(spur[j]), from + j);
+		}
+		if (candidates.empty())
+			break;
+		found.push_back(candidates.begin()->first);
+		deviation.push_back(candidates.begin()->second);
+		candidates.erase(candidates.begin());
+	}
+	return found;
+}
+
+} // namespace dx
@@ -0,0 +1,253 @@
+// mapped_reduce.h
+// Map/reduce over a binary file of fixed-size records.
+//
+// The file is never mapped as a whole. It is cut into chunks that are a
+// multiple of the page size (and of the record size), several per worker;
+// workers claim chunks in file order from a shared cursor, so a worker
+// that hits expensive records simply claims fewer. A worker maps one
+// chunk, reduces it, and unmaps it before claiming the next, so resident
+// memory stays at about one chunk per worker however large the file is.
+// Each chunk is mapped with a sequential-access hint, so the kernel reads
+// ahead of the faults, and on claiming a chunk a worker asks the kernel to
+// start reading the one that will be claimed a round later.
+#pragma once
+#include "ppl.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dx {
+
+struct mapped_options
+{
+	// Most bytes per chunk; rounded up to whole pages and records. Smaller
+	// files are cut into smaller chunks so that every worker gets several.
+	std::size_t chunk_bytes = std::size_t(8) << 20;
+	// Drop each chunk from the page cache once it has been reduced.
+	bool drop_cache = false;
+};
+
+// Read-only file that hands out mappings of byte ranges.
+class mapped_file
+{
+public:
+	// One mapped range; unmapped when destroyed.
+	class view
+	{
+	public:
+		view(const view&) = delete;
+		view& operator=(const view&) = delete;
+		view(view&& o) : _base(o._base), _data(o._data), _size(o._size) { o._base = nullptr; }
+
+		~view()
+		{
+			if (!_base)
+				return;
+#ifdef _WIN32
+			UnmapViewOfFile(_base);
+#else
+			munmap(_base, _size + (_data - static_cast<const char*>(_base)));
+#endif
+		}
+
+		const char* data() const { return _data; }
+		std::size_t size() const { return _size; }
+
+	private:
+		friend class mapped_file;
+		view(void* base, const char* data, std::size_t size) : _base(base), _data(data), _size(size) {}
+
+		void* _base;
+		const char* _data;
+		std::size_t _size;
+	};
+
+	explicit mapped_file(const std::string& path)
+	{
+#ifdef _WIN32
+		_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (_file == INVALID_HANDLE_VALUE)
+			throw std::system_error(int(GetLastError()), std::system_category(), path);
+		LARGE_INTEGER size;
+		GetFileSizeEx(_file, &size);
+		_size = std::uint64_t(size.QuadPart);
+		_mapping = _size ? CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		_granularity = info.dwAllocationGranularity;
+#else
+		_fd = ::open(path.c_str(), O_RDONLY);
+		if (_fd < 0)
+			throw std::system_error(errno, std::generic_category(), path);
+		struct stat st;
+		if (fstat(_fd, &st) != 0)
+		{
+			int e = errno;
+			::close(_fd);
+			throw std::system_error(e, std::generic_category(), path);
+		}
+		_size = std::uint64_t(st.st_size);
+		_granularity = std::size_t(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	~mapped_file()
+	{
+#ifdef _WIN32
+		if (_mapping)
+			CloseHandle(_mapping);
+		CloseHandle(_file);
+#else
+		::close(_fd);
+#endif
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	std::uint64_t size() const { return _size; }
+
+	// Alignment that map() offsets must have.
+	std::size_t granularity() const { return _granularity; }
+
+	// Maps [offset, offset + length); offset must be a multiple of granularity().
+	view map(std::uint64_t offset, std::size_t length) const
+	{
+#ifdef _WIN32
+		void* p = MapViewOfFile(_mapping, FILE_MAP_READ,
+			DWORD(offset >> 32), DWORD(offset & 0xffffffffu), length);
+		if (!p)
+			throw std::system_error(int(GetLastError()), std::system_category(), "MapViewOfFile");
+#else
+		void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, _fd, off_t(offset));
+		if (p == MAP_FAILED)
+			throw std::system_error(errno, std::generic_category(), "mmap");
+		madvise(p, length, MADV_SEQUENTIAL);
+#endif
+		return view(p, static_cast<const char*>(p), length);
+	}
+
+	// Starts reading [offset, offset + length) into the page cache.
+	void prefetch(std::uint64_t offset, std::size_t length) const
+	{
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+		posix_fadvise(_fd, off_t(offset), off_t(length), POSIX_FADV_WILLNEED);
+#else
+		(void)offset;
+		(void)length;
+#endif
+	}
+
+	// Tells the kernel [offset, offset + length) will not be read again.
+	void drop(std::uint64_t offset, std::size_t length) const
+	{
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+		posix_fadvise(_fd, off_t(offset), off_t(length), POSIX_FADV_DONTNEED);
+#else
+		(void)offset;
+		(void)length;
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE _file;
+	HANDLE _mapping;
+#else
+	int _fd;
+#endif
+	std::uint64_t _size;
+	std::size_t _granularity;
+};
+
+namespace detail {
+
+inline std::size_t gcd(std::size_t a, std::size_t b)
+{
+	while (b)
+	{
+		std::size_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+} // namespace detail
+
+// Reduces map(record) over every T record of the file with the
+// associative reduce, like parallel_transform followed by parallel_reduce.
+// Chunk results are combined in file order. Trailing bytes that do not
+// form a whole record are ignored.
+template <class T, class R, class Map, class Reduce>
+R mapped_reduce(const std::string& path, const R& identity, const Map& map,
+	const Reduce& reduce, const mapped_options& options = mapped_options())
+{
+	mapped_file file(path);
+	const std::uint64_t records = file.size() / sizeof(T);
+	if (records == 0)
+		return identity;
+	const std::uint64_t bytes = records * sizeof(T);
+
+	// Chunks hold whole pages and whole records: about four per worker, as
+	// auto_grain cuts ranges, but no smaller than 64 KiB, under which a
+	// mapping costs more than reading it, and no larger than chunk_bytes.
+	const std::size_t workers = scheduler::instance().concurrency();
+	const std::size_t unit = file.granularity() / detail::gcd(file.granularity(), sizeof(T)) * sizeof(T);
+	std::uint64_t target = bytes / (4 * workers);
+	if (target < (std::uint64_t(64) << 10))
+		target = std::uint64_t(64) << 10;
+	if (target > options.chunk_bytes)
+		target = options.chunk_bytes;
+	const std::size_t chunk = std::size_t((target + unit - 1) / unit * unit);
+	const std::size_t chunks = std::size_t((bytes + chunk - 1) / chunk);
+
+	// One result per chunk, combined in file order afterwards.
+	std::vector<R> partial(chunks, identity);
+	std::atomic<std::size_t> cursor(0);
+	const std::size_t runs = (std::min)(workers, chunks);
+	parallel_for(std::size_t(0), runs, [&](std::size_t) {
+		for (std::size_t c; (c = cursor.fetch_add(1, std::memory_order_relaxed)) < chunks;)
+		{
+			std::uint64_t offset = std::uint64_t(c) * chunk;
+			std::size_t length = std::size_t(std::min<std::uint64_t>(chunk, bytes - offset));
+			// The other runs are about to claim the chunks before c + runs.
+			if (c + runs < chunks)
+			{
+				std::uint64_t ahead = std::uint64_t(c + runs) * chunk;
+				file.prefetch(ahead, std::size_t(std::min<std::uint64_t>(chunk, bytes - ahead)));
+			}
+			R acc = identity;
+			{
+				mapped_file::view v = file.map(offset, length);
+				const T* p = reinterpret_cast<const T*>(v.data());
+				const T* e = p + length / sizeof(T);
+				for (; p != e; ++p)
+					acc = reduce(acc, map(*p));
+			}
+			partial[c] = acc;
+			if (options.drop_cache)
+				file.drop(offset, length);
+		}
+	});
+
+	R result = identity;
+	for (auto& p : partial)
+		result = reduce(result, p);
+	return result;
+}
+
+} // namespace dx
@@ -0,0 +1,243 @@
+// parallel_sort.h
+// parallel_sort, parallel_buffered_sort and parallel_radixsort with the
+// call shapes of the PPL ones.
+#pragma once
+#include "ppl.h"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+namespace dx {
+
+namespace detail {
+
+// Below this many elements the sorts fall back to std::sort / std::merge.
+const std::ptrdiff_t sort_cutoff = 2048;
+
+template <class It, class Cmp>
+It median_of_three(It a, It b, It c, const Cmp& cmp)
+{
+	if (cmp(*a, *b))
+		return cmp(*b, *c) ? b : (cmp(*a, *c) ? c : a);
+	return cmp(*a, *c) ? a : (cmp(*b, *c) ? c : b);
+}
+
+template <class It, class Cmp>
+void quick_sort(It first, It last, const Cmp& cmp, int depth)
+{
+	if (last - first > sort_cutoff)
+	{
+		if (depth-- == 0)
+		{
+			// Degenerate pivots: let the introsort in std::sort take over.
+			std::sort(first, last, cmp);
+			return;
+		}
+		std::ptrdiff_t n = last - first;
+		std::ptrdiff_t s = n / 8;
+		It m = median_of_three(
+			median_of_three(first, first + s, first + 2 * s, cmp),
+			median_of_three(first + n / 2 - s, first + n / 2, first + n / 2 + s, cmp),
+			median_of_three(last - 1 - 2 * s, last - 1 - s, last - 1, cmp), cmp);
+		auto pivot = *m;
+		It mid1 = std::partition(first, last, [&](const decltype(pivot)& x) { return cmp(x, pivot); });
+		It mid2 = std::partition(mid1, last, [&](const decltype(pivot)& x) { return !cmp(pivot, x); });
+		parallel_invoke(
+			[=, &cmp] { quick_sort(first, mid1, cmp, depth); },
+			[=, &cmp] { quick_sort(mid2, last, cmp, depth); });
+		return;
+	}
+	std::sort(first, last, cmp);
+}
+
+// Stable merge of [first1, last1) and [first2, last2) into out. Splits the
+// larger input at its middle and the smaller one at the matching bound.
+template <class It1, class It2, class OutIt, class Cmp>
+void merge_move(It1 first1, It1 last1, It2 first2, It2 last2, OutIt out, const Cmp& cmp)
+{
+	std::ptrdiff_t n1 = last1 - first1, n2 = last2 - first2;
+	if (n1 + n2 <= sort_cutoff)
+	{
+		while (first1 != last1 && first2 != last2)
+		{
+			if (cmp(*first2, *first1))
+				*out++ = std::move(*first2++);
+			else
+				*out++ = std::move(*first1++);
+		}
+		std::move(first2, last2, std::move(first1, last1, out));
+		return;
+	}
+	It1 m1;
+	It2 m2;
+	if (n1 >= n2)
+	{
+		m1 = first1 + n1 / 2;
+		m2 = std::lower_bound(first2, last2, *m1, cmp);
+	}
+	else
+	{
+		m2 = first2 + n2 / 2;
+		m1 = std::upper_bound(first1, last1, *m2, cmp);
+	}
+	OutIt mid = out + (m1 - first1) + (m2 - first2);
+	parallel_invoke(
+		[=, &cmp] { merge_move(first1, m1, first2, m2, out, cmp); },
+		[=, &cmp] { merge_move(m1, last1, m2, last2, mid, cmp); });
+}
+
+// Sorts [a, a + n); the result ends up in buf when to_buf is set.
+template <class It, class BufIt, class Cmp>
+void merge_sort(It a, BufIt buf, std::ptrdiff_t n, bool to_buf, const Cmp& cmp)
+{
+	if (n <= sort_cutoff)
+	{
+		std::stable_sort(a, a + n, cmp);
+		if (to_buf)
+			std::move(a, a + n, buf);
+		return;
+	}
+	std::ptrdiff_t m = n / 2;
+	parallel_invoke(
+		[=, &cmp] { merge_sort(a, buf, m, !to_buf, cmp); },
+		[=, &cmp] { merge_sort(a + m, buf + m, n - m, !to_buf, cmp); });
+	if (to_buf)
+		merge_move(a, a + m, a + m, a + n, buf, cmp);
+	else
+		merge_move(buf, buf + m, buf + m, buf + n, a, cmp);
+}
+
+struct radix_identity
+{
+	template <class T>
+	std::size_t operator()(const T& x) const { return std::size_t(x); }
+};
+
+} // namespace detail
+
+// In-place unstable parallel sort (parallel quicksort).
+template <class It, class Cmp>
+void parallel_sort(It first, It last, const Cmp& cmp)
+{
+	std::ptrdiff_t n = last - first;
+	int depth = 0;
+	while (n > 1)
+	{
+		depth += 2;
+		n >>= 1;
+	}
+	detail::quick_sort(first, last, cmp, depth);
+}
+
+template <class It>
+void parallel_sort(It first, It last)
+{
+	parallel_sort(first, last, std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+// Stable parallel merge sort using an O(n) buffer.
+template <class It, class Cmp>
+void parallel_buffered_sort(It first, It last, const Cmp& cmp)
+{
+	typedef typename std::iterator_traits<It>::value_type T;
+	std::ptrdiff_t n = last - first;
+	if (n <= detail::sort_cutoff)
+	{
+		std::stable_sort(first, last, cmp);
+		return;
+	}
+	std::vector<T> buf(n);
+	detail::merge_sort(first, buf.begin(), n, false, cmp);
+}
+
+template <class It>
+void parallel_buffered_sort(It first, It last)
+{
+	parallel_buffered_sort(first, last, std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+// Stable LSD radix sort on the unsigned key proj(x), one byte per pass.
+// Passes whose byte is the same for every element are skipped.
+template <class It, class Proj>
+void parallel_radixsort(It first, It last, const Proj& proj)
+{
+	typedef typename std::iterator_traits<It>::value_type T;
+	const std::size_t radix = 256;
+	std::size_t n = std::size_t(last - first);
+	if (n < 2)
+		return;
+
+	std::size_t chunks = scheduler::instance().concurrency() * 4;
+	if (chunks > n)
+		chunks = n;
+	std::size_t chunk_size = (n + chunks - 1) / chunks;
+	chunks = (n + chunk_size - 1) / chunk_size;
+
+	std::size_t max_key = parallel_reduce(first, last, std::size_t(0),
+		[&proj](It b, It e, std::size_t m) {
+			for (; b != e; ++b)
+				m = std::max(m, std::size_t(proj(*b)));
+			return m;
+		},
+		[](std::size_t x, std::size_t y) { return std::max(x, y); });
+
+	std::vector<T> buf(n);
+	std::vector<std::size_t> counts(chunks * radix);
+	bool in_buf = false;
+
+	for (unsigned shift = 0; shift < sizeof(std::size_t) * 8 && (max_key >> shift) != 0; shift += 8)
+	{
+		auto digit = [&](const T& x) { return (std::size_t(proj(x)) >> shift) & (radix - 1); };
+		auto run_pass = [&](auto src, auto dst) {
+			parallel_for(std::size_t(0), chunks, [&](std::size_t c) {
+				std::size_t* cnt = &counts[c * radix];
+				std::fill(cnt, cnt + radix, 0);
+				std::size_t e = std::min(n, (c + 1) * chunk_size);
+				for (std::size_t i = c * chunk_size; i < e; ++i)
+					++cnt[digit(src[i])];
+			});
+
+			// Offsets: digit-major, chunk-minor keeps the sort stable.
+			std::size_t sum = 0;
+			bool trivial = false;
+			for (std::size_t d = 0; d < radix; ++d)
+			{
+				std::size_t digit_total = 0;
+				for (std::size_t c = 0; c < chunks; ++c)
+				{
+					std::size_t k = counts[c * radix + d];
+					counts[c * radix + d] = sum;
+					sum += k;
+					digit_total += k;
+				}
+				if (digit_total == n)
+					trivial = true;
+			}
+			if (trivial)
+				return false;
+
+			parallel_for(std::size_t(0), chunks, [&](std::size_t c) {
+				std::size_t* off = &counts[c * radix];
+				std::size_t e = std::min(n, (c + 1) * chunk_size);
+				for (std::size_t i = c * chunk_size; i < e; ++i)
+					dst[off[digit(src[i])]++] = std::move(src[i]);
+			});
+			return true;
+		};
+		bool moved = in_buf ? run_pass(buf.begin(), first) : run_pass(first, buf.begin());
+		if (moved)
+			in_buf = !in_buf;
+	}
+	if (in_buf)
+		parallel_transform(buf.begin(), buf.end(), first, [](T& x) { return std::move(x); });
+}
+
+template <class It>
+void parallel_radixsort(It first, It last)
+{
+	parallel_radixsort(first, last, detail::radix_identity());
+}
+
+} // namespace dx
@@ -0,0 +1,198 @@
+// partition.h
+// parallel_partition and parallel_stable_partition, the parallel
+// std::partition / std::stable_partition.
+//
+// parallel_partition partitions blocks of the input in parallel, which
+// leaves every block as its matches followed by its misses. With T matches
+// in all, the misses that lie left of T and the matches that lie right of
+// it are equally many; both are a list of runs, one per block at most, and
+// the k-th misplaced miss is swapped with the k-th misplaced match in
+// parallel. Apart from two counts per block it needs no memory.
+//
+// parallel_stable_partition stable-partitions halves in parallel down to
+// blocks, which std::stable_partition handles with a buffer of at most a
+// block, and joins two partitioned halves by rotating the misses of the
+// left one past the matches of the right one. A large rotation is done as
+// three reversals, each swapping in parallel. Every level of the recursion
+// moves each element at most twice.
+//
+// Inputs that are not random access get the serial algorithms, and so
+// does parallel_partition on a single worker.
+#pragma once
+#include "ppl.h"
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace dx {
+
+namespace detail {
+
+// Blocks of about an eighth of a worker's share, and no smaller than 16K
+// elements, under which the task overhead dominates.
+inline std::size_t partition_block(std::size_t n)
+{
+	const std::size_t min_block = 16 * 1024;
+	std::size_t block = n / (8 * scheduler::instance().concurrency());
+	return block < min_block ? min_block : block;
+}
+
+// A run of misplaced elements, [pos, pos + len).
+struct partition_run
+{
+	std::size_t pos;
+	std::size_t len;
+};
+
+// Swaps the element at k of the concatenated runs a with the one at k of
+// the concatenated runs b, for lo <= k < hi. offsets give where every run
+// starts in its concatenation.
+template <class It>
+void swap_runs(It first, const std::vector<partition_run>& a, const std::vector<std::size_t>& a_offsets,
+	const std::vector<partition_run>& b, const std::vector<std::size_t>& b_offsets, std::size_t lo, std::size_t hi)
+{
+	std::size_t i = std::size_t(std::upper_bound(a_offsets.begin(), a_offsets.end(), lo) - a_offsets.begin()) - 1;
+	std::size_t j = std::size_t(std::upper_bound(b_offsets.begin(), b_offsets.end(), lo) - b_offsets.begin()) - 1;
+	std::size_t ai = lo - a_offsets[i], bj = lo - b_offsets[j];
+	while (lo < hi)
+	{
+		const std::size_t len = (std::min)({ hi - lo, a[i].len - ai, b[j].len - bj });
+		std::swap_ranges(std::next(first, a[i].pos + ai), std::next(first, a[i].pos + ai + len),
+			std::next(first, b[j].pos + bj));
+		lo += len;
+		ai += len;
+		bj += len;
+		if (ai == a[i].len)
+			++i, ai = 0;
+		if (bj == b[j].len)
+			++j, bj = 0;
+	}
+}
+
+template <class It>
+void parallel_reverse(It first, It last)
+{
+	const std::size_t half = std::size_t(std::distance(first, last)) / 2;
+	if (half < 16 * 1024)
+	{
+		std::reverse(first, last);
+		return;
+	}
+	for_range(0, half, auto_grain(half), [&](std::size_t lo, std::size_t hi) {
+		std::swap_ranges(std::next(first, lo), std::next(first, hi),
+			std::reverse_iterator<It>(std::prev(last, std::ptrdiff_t(lo))));
+	});
+}
+
+// std::rotate(first, middle, last), by reversals when it is large.
+template <class It>
+void parallel_rotate(It first, It middle, It last)
+{
+	if (first == middle || middle == last)
+		return;
+	if (std::distance(first, last) < 64 * 1024)
+	{
+		std::rotate(first, middle, last);
+		return;
+	}
+	parallel_invoke(
+		[&] { parallel_reverse(first, middle); },
+		[&] { parallel_reverse(middle, last); });
+	parallel_reverse(first, last);
+}
+
+template <class It, class Pred>
+It stable_partition_range(It first, It last, const Pred& pred, std::size_t block)
+{
+	const std::size_t n = std::size_t(std::distance(first, last));
+	if (n <= block)
+		return std::stable_partition(first, last, pred);
+	const It mid = std::next(first, std::ptrdiff_t(n / 2));
+	It left, right;
+	parallel_invoke(
+		[&] { left = stable_partition_range(first, mid, pred, block); },
+		[&] { right = stable_partition_range(mid, last, pred, block); });
+	parallel_rotate(left, mid, right);
+	return std::next(left, std::distance(mid, right));
+}
+
+} // namespace detail
+
+// Moves the elements that satisfy pred before those that do not and
+// returns the start of the second group. The order within either group is
+// not kept.
+template <class It, class Pred>
+It parallel_partition(It first, It last, const Pred& pred)
+{
+	if constexpr (!detail::is_random_access<It>::value)
+	{
+		return std::partition(first, last, pred);
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		const std::size_t block = detail::partition_block(n);
+		if (scheduler::instance().concurrency() == 1 || n <= block)
+			return std::partition(first, last, pred);
+		const std::size_t blocks = (n + block - 1) / block;
+
+		std::vector<std::size_t> matches(blocks);
+		parallel_for(std::size_t(0), blocks, [&](std::size_t b) {
+			const It lo = std::next(first, b * block), hi = std::next(first, (std::min)(n, (b + 1) * block));
+			matches[b] = std::size_t(std::distance(lo, std::partition(lo, hi, pred)));
+		});
+		std::size_t total = 0;
+		for (std::size_t m : matches)
+			total += m;
+
+		// Misses left of total and matches right of it, in position order.
+		std::vector<detail::partition_run> misses, extra;
+		std::vector<std::size_t> miss_offsets, extra_offsets;
+		std::size_t misplaced = 0, surplus = 0;
+		for (std::size_t b = 0; b < blocks; ++b)
+		{
+			const std::size_t lo = b * block, hi = (std::min)(n, lo + block), split = lo + matches[b];
+			if (split < total && split < hi)
+			{
+				miss_offsets.push_back(misplaced);
+				misses.push_back({ split, (std::min)(hi, total) - split });
+				misplaced += misses.back().len;
+			}
+			if (split > total && lo < split)
+			{
+				const std::size_t pos = (std::max)(lo, total);
+				extra_offsets.push_back(surplus);
+				extra.push_back({ pos, split - pos });
+				surplus += extra.back().len;
+			}
+		}
+		if (misplaced != 0)
+		{
+			detail::for_range(0, misplaced, (std::max)(std::size_t(4096), detail::auto_grain(misplaced)),
+				[&](std::size_t lo, std::size_t hi) {
+					detail::swap_runs(first, misses, miss_offsets, extra, extra_offsets, lo, hi);
+				});
+		}
+		return std::next(first, total);
+	}
+}
+
+// As parallel_partition, but either group keeps its input order.
+// Needs a buffer of at most one block per worker.
+template <class It, class Pred>
+It parallel_stable_partition(It first, It last, const Pred& pred)
+{
+	if constexpr (!detail::is_random_access<It>::value)
+	{
+		return std::stable_partition(first, last, pred);
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		return detail::stable_partition_range(first, last, pred, detail::partition_block(n));
+	}
+}
+
+} // namespace dx
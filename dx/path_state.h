@@ -0,0 +1,133 @@
+// path_state.h
+// The path of one branch of a parallel graph search, without heap
+// allocation per step.
+//
+// A path is a chain of links from its last node back to its first, each
+// link holding a node and its parent. Links come from per-worker arenas
+// (path_arenas) and are never changed once linked, so a branch forked off
+// a path shares every link up to the fork instead of copying the path.
+// Which nodes are on the path is a bitset the branch owns, copied into the
+// arena at the fork.
+//
+// push() and pop() are O(1): a link and a bit. A link a branch pops is
+// kept and reused by its next push, so a depth-first search inside one
+// branch stops allocating after reaching its deepest path. Links from
+// before the fork are never reused. nodes() rebuilds the path in one walk
+// of the chain.
+//
+// Forked branches must end before the path they were forked from pops
+// below the fork point, as they do under parallel_for.
+#pragma once
+#include "arena.h"
+#include "combinable.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace dx {
+
+// Per-worker arenas of one search. Everything allocated from them lives
+// until the search object is destroyed.
+class path_arenas
+{
+public:
+	path_arenas() : _arenas([] { return std::unique_ptr<arena>(new arena(64 * 1024)); }) {}
+
+	arena& local() { return *_arenas.local(); }
+
+private:
+	combinable<std::unique_ptr<arena>> _arenas;
+};
+
+class path_state
+{
+	struct link
+	{
+		link* parent;
+		int node;
+	};
+
+public:
+	// An empty path in a graph of nodes nodes; its bitset comes from a.
+	path_state(arena& a, std::size_t nodes)
+		: _tail(nullptr), _spare(nullptr), _words((nodes + 63) / 64), _size(0), _base(0)
+	{
+		_visited = a.allocate_array<std::uint64_t>(_words);
+		std::fill(_visited, _visited + _words, 0);
+	}
+
+	std::size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+
+	// Last node; the path is not empty.
+	int back() const { return _tail->node; }
+
+	bool contains(int v) const
+	{
+		return (_visited[std::size_t(v) / 64] >> (std::size_t(v) % 64)) & 1;
+	}
+
+	// Appends v, which is not on the path.
+	void push(arena& a, int v)
+	{
+		link* l = _spare;
+		if (l)
+			_spare = l->parent;
+		else
+			l = a.create<link>();
+		l->parent = _tail;
+		l->node = v;
+		_tail = l;
+		_visited[std::size_t(v) / 64] |= std::uint64_t(1) << (std::size_t(v) % 64);
+		++_size;
+	}
+
+	// Removes the last node.
+	void pop()
+	{
+		link* l = _tail;
+		_visited[std::size_t(l->node) / 64] &= ~(std::uint64_t(1) << (std::size_t(l->node) % 64));
+		_tail = l->parent;
+		if (_size-- > _base)
+		{
+			l->parent = _spare;
+			_spare = l;
+		}
+	}
+
+	// A branch with the same path, sharing its links; its bitset comes
+	// from a. (A plain copy would share the bitset too.)
+	path_state fork(arena& a) const
+	{
+		path_state b(*this);
+		b._spare = nullptr;
+		b._base = _size;
+		b._visited = a.allocate_array<std::uint64_t>(_words);
+		std::copy(_visited, _visited + _words, b._visited);
+		return b;
+	}
+
+	// The nodes from the first to the last.
+	std::vector<int> nodes() const
+	{
+		std::vector<int> out(_size);
+		std::size_t i = _size;
+		for (const link* l = _tail; l; l = l->parent)
+			out[--i] = l->node;
+		return out;
+	}
+
+private:
+	link* _tail;
+	link* _spare;
+	std::uint64_t* _visited;
+	std::size_t _words;
+	std::size_t _size;
+	// Links of the first _base nodes belong to the path this was forked
+	// from.
+	std::size_t _base;
+};
+
+} // namespace dx
@@ -0,0 +1,356 @@
+// perf_counters.h
+// Hardware and scheduler counters around a region of code, per thread.
+//
+// perf_call(f) runs f like time_call does, with Linux perf_event_open
+// counters attached to every thread of the process (the worker pool
+// included): cycles, instructions, last-level cache read misses, branch
+// misses, context switches and task clock, i.e. the CPU time a thread
+// actually ran. Comparing the task clock of the workers with the wall
+// time shows idle workers; IPC, LLC and branch misses show whether the
+// busy ones are stalled.
+//
+// Counters that cannot be opened (no PMU in a VM or container, a strict
+// perf_event_paranoid, not Linux) are left out of the report, which says
+// why; with none at all the report is the wall clock only. Multiplexed
+// counters are scaled by enabled / running time.
+#pragma once
+#include "scheduler.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <cerrno>
+#include <dirent.h>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace dx {
+
+enum perf_event
+{
+	perf_cycles,
+	perf_instructions,
+	perf_llc_misses,
+	perf_branch_misses,
+	perf_context_switches,
+	perf_task_clock, // nanoseconds
+	perf_event_count
+};
+
+inline const char* perf_event_name(int e)
+{
+	static const char* const names[perf_event_count] = {
+		"cycles", "instructions", "llc-misses", "branch-misses", "ctx-switches", "task-clock"
+	};
+	return names[e];
+}
+
+struct perf_values
+{
+	std::uint64_t value[perf_event_count] = {};
+	bool valid[perf_event_count] = {};
+
+	perf_values& operator+=(const perf_values& o)
+	{
+		for (int e = 0; e < perf_event_count; ++e)
+		{
+			if (o.valid[e])
+			{
+				value[e] += o.value[e];
+				valid[e] = true;
+			}
+		}
+		return *this;
+	}
+};
+
+struct perf_thread_values : perf_values
+{
+	int tid = 0;
+	std::string name;
+};
+
+struct perf_report
+{
+	double wall_ms = 0;
+	// Whether any counter could be opened; otherwise only wall_ms is set.
+	bool counters = false;
+	// Why counters are missing, empty if all of them worked.
+	std::string message;
+	std::vector<perf_thread_values> threads;
+	perf_values total;
+
+	void print(std::ostream& out) const
+	{
+		char line[200];
+		std::snprintf(line, sizeof(line), "wall %.3f ms", wall_ms);
+		out << line;
+		if (!message.empty())
+			out << "; " << message;
+		out << "\n";
+		if (!counters)
+			return;
+		int n = std::snprintf(line, sizeof(line), "%-24s", "thread");
+		for (int e = 0; e < perf_event_count; ++e)
+			n += std::snprintf(line + n, sizeof(line) - n, " %14s", perf_event_name(e));
+		out << line << "\n";
+		for (auto& t : threads)
+			print_row(out, std::to_string(t.tid) + " " + t.name, t);
+		print_row(out, "total", total);
+		if (total.valid[perf_cycles] && total.valid[perf_instructions] && total.value[perf_cycles])
+		{
+			std::snprintf(line, sizeof(line), "IPC %.2f",
+				double(total.value[perf_instructions]) / double(total.value[perf_cycles]));
+			out << line;
+			if (total.valid[perf_task_clock] && wall_ms > 0)
+			{
+				std::snprintf(line, sizeof(line), ", busy threads %.2f",
+					double(total.value[perf_task_clock]) / 1e6 / wall_ms);
+				out << line;
+			}
+			out << "\n";
+		}
+		else if (total.valid[perf_task_clock] && wall_ms > 0)
+		{
+			std::snprintf(line, sizeof(line), "busy threads %.2f\n",
+				double(total.value[perf_task_clock]) / 1e6 / wall_ms);
+			out << line;
+		}
+	}
+
+private:
+	static void print_row(std::ostream& out, const std::string& label, const perf_values& v)
+	{
+		char line[200];
+		int n = std::snprintf(line, sizeof(line), "%-24.24s", label.c_str());
+		for (int e = 0; e < perf_event_count; ++e)
+		{
+			if (v.valid[e])
+				n += std::snprintf(line + n, sizeof(line) - n, " %14llu", (unsigned long long)v.value[e]);
+			else
+				n += std::snprintf(line + n, sizeof(line) - n, " %14s", "-");
+		}
+		out << line << "\n";
+	}
+};
+
+// Counters of every thread that exists when it is constructed.
+class perf_counters
+{
+public:
+	perf_counters()
+	{
+#ifdef __linux__
+		std::string failed[perf_event_count];
+		for (int tid : list_threads())
+		{
+			thread t;
+			t.tid = tid;
+			for (int e = 0; e < perf_event_count; ++e)
+			{
+				t.fd[e] = open_event(e, tid);
+				if (t.fd[e] >= 0)
+					_any = true;
+				else if (failed[e].empty())
+					failed[e] = std::strerror(errno);
+			}
+			_threads.push_back(t);
+		}
+		for (int e = 0; e < perf_event_count; ++e)
+		{
+			if (!failed[e].empty())
+			{
+				_message += _message.empty() ? "unavailable: " : ", ";
+				_message += std::string(perf_event_name(e)) + " (" + failed[e] + ")";
+			}
+		}
+		if (!_any)
+			_message = "no performance counters (" + _message + "), wall clock only";
+#else
+		_message = "performance counters need Linux perf_event_open, wall clock only";
+#endif
+	}
+
+	~perf_counters()
+	{
+#ifdef __linux__
+		for (auto& t : _threads)
+		{
+			for (int fd : t.fd)
+			{
+				if (fd >= 0)
+					::close(fd);
+			}
+		}
+#endif
+	}
+
+	perf_counters(const perf_counters&) = delete;
+	perf_counters& operator=(const perf_counters&) = delete;
+
+	bool available() const { return _any; }
+	const std::string& message() const { return _message; }
+
+	void start()
+	{
+#ifdef __linux__
+		for_each_fd([](int fd) {
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		});
+#endif
+	}
+
+	void stop()
+	{
+#ifdef __linux__
+		for_each_fd([](int fd) { ioctl(fd, PERF_EVENT_IOC_DISABLE, 0); });
+#endif
+	}
+
+	// Values since start(); wall_ms is left to the caller.
+	perf_report read() const
+	{
+		perf_report r;
+		r.counters = _any;
+		r.message = _message;
+#ifdef __linux__
+		for (auto& t : _threads)
+		{
+			perf_thread_values v;
+			v.tid = t.tid;
+			v.name = thread_name(t.tid);
+			for (int e = 0; e < perf_event_count; ++e)
+			{
+				std::uint64_t buf[3]; // value, time enabled, time running
+				if (t.fd[e] < 0 || ::read(t.fd[e], buf, sizeof(buf)) != ssize_t(sizeof(buf)))
+					continue;
+				v.value[e] = buf[2] && buf[2] < buf[1]
+					? std::uint64_t(double(buf[0]) * double(buf[1]) / double(buf[2])) : buf[0];
+				v.valid[e] = true;
+			}
+			r.total += v;
+			r.threads.push_back(v);
+		}
+#endif
+		return r;
+	}
+
+private:
+#ifdef __linux__
+	struct thread
+	{
+		int tid;
+		int fd[perf_event_count];
+	};
+
+	static std::vector<int> list_threads()
+	{
+		std::vector<int> tids;
+		if (DIR* d = opendir("/proc/self/task"))
+		{
+			while (dirent* e = readdir(d))
+			{
+				if (e->d_name[0] != '.')
+					tids.push_back(std::atoi(e->d_name));
+			}
+			closedir(d);
+		}
+		return tids;
+	}
+
+	static std::string thread_name(int tid)
+	{
+		std::string name;
+		std::ifstream comm("/proc/self/task/" + std::to_string(tid) + "/comm");
+		std::getline(comm, name);
+		return name;
+	}
+
+	static int open_event(int e, int tid)
+	{
+		perf_event_attr a;
+		std::memset(&a, 0, sizeof(a));
+		a.size = sizeof(a);
+		a.disabled = 1;
+		a.exclude_hv = 1;
+		a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		switch (e)
+		{
+		case perf_cycles:
+			a.type = PERF_TYPE_HARDWARE;
+			a.config = PERF_COUNT_HW_CPU_CYCLES;
+			break;
+		case perf_instructions:
+			a.type = PERF_TYPE_HARDWARE;
+			a.config = PERF_COUNT_HW_INSTRUCTIONS;
+			break;
+		case perf_llc_misses:
+			a.type = PERF_TYPE_HW_CACHE;
+			a.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			break;
+		case perf_branch_misses:
+			a.type = PERF_TYPE_HARDWARE;
+			a.config = PERF_COUNT_HW_BRANCH_MISSES;
+			break;
+		case perf_context_switches:
+			a.type = PERF_TYPE_SOFTWARE;
+			a.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+			break;
+		default:
+			a.type = PERF_TYPE_SOFTWARE;
+			a.config = PERF_COUNT_SW_TASK_CLOCK;
+			break;
+		}
+		// User space only, which an unprivileged process may count, except
+		// for context switches: those only happen in the kernel.
+		a.exclude_kernel = e == perf_context_switches ? 0 : 1;
+		return int(syscall(SYS_perf_event_open, &a, tid, -1, -1, 0));
+	}
+
+	template <class F>
+	void for_each_fd(const F& f)
+	{
+		for (auto& t : _threads)
+		{
+			for (int fd : t.fd)
+			{
+				if (fd >= 0)
+					f(fd);
+			}
+		}
+	}
+
+	std::vector<thread> _threads;
+#endif
+	bool _any = false;
+	std::string _message;
+};
+
+// Runs f with counters on every thread of the process and returns them
+// with the wall time. Never fails for lack of counters.
+template <class Function>
+perf_report perf_call(Function&& f)
+{
+	scheduler::instance(); // the worker pool must exist to be counted
+	perf_counters counters;
+	counters.start();
+	auto begin = std::chrono::steady_clock::now();
+	f();
+	auto end = std::chrono::steady_clock::now();
+	counters.stop();
+	perf_report r = counters.read();
+	r.wall_ms = std::chrono::duration<double, std::milli>(end - begin).count();
+	return r;
+}
+
+} // namespace dx
@@ -0,0 +1,222 @@
+// pipeline.h
+// Lazy parallel range pipelines that run every stage in one pass.
+//
+//   long long s = pipe::source(a)
+//       | pipe::filter(is_carmichael)
+//       | pipe::transform([](int n) { return (long long)n; })
+//       | pipe::reduce(0LL, std::plus<long long>());
+//
+// source(), filter() and transform() only build a description; nothing
+// runs until a terminal (reduce, count, for_each) is applied. The terminal
+// cuts the source into chunks as parallel_reduce does, and every worker
+// pushes each element of its chunk through all stages into its own
+// accumulator before it reads the next one. A value lives in registers
+// from the load to the accumulator, so no stage writes an intermediate
+// array, and the source is read once.
+//
+// Stages are in namespace dx::pipe, as filter/transform/reduce would clash
+// with the std algorithms under using namespace std.
+#pragma once
+#include "ppl.h"
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace dx {
+namespace pipe {
+
+// Passes on the values that satisfy pred.
+template <class Pred>
+struct filter_stage
+{
+	Pred pred;
+
+	template <class Sink>
+	auto bind(Sink sink) const
+	{
+		return [pred = pred, sink](auto&& v) mutable {
+			if (pred(v))
+				sink(std::forward<decltype(v)>(v));
+		};
+	}
+};
+
+// Passes on f(value).
+template <class F>
+struct transform_stage
+{
+	F f;
+
+	template <class Sink>
+	auto bind(Sink sink) const
+	{
+		return [f = f, sink](auto&& v) mutable { sink(f(std::forward<decltype(v)>(v))); };
+	}
+};
+
+// A source range and the stages its elements go through, first stage
+// first.
+template <class It, class... Stages>
+class pipeline
+{
+public:
+	pipeline(It first, It last, std::tuple<Stages...> stages)
+		: _first(first), _last(last), _stages(std::move(stages))
+	{
+	}
+
+	It begin() const { return _first; }
+	It end() const { return _last; }
+
+	template <class Stage>
+	pipeline<It, Stages..., Stage> then(Stage s) const
+	{
+		return pipeline<It, Stages..., Stage>(_first, _last, std::tuple_cat(_stages, std::make_tuple(std::move(s))));
+	}
+
+	// The function a source element is pushed into: all stages, ending in
+	// sink.
+	template <class Sink>
+	auto bind(Sink sink) const
+	{
+		return bind_from<0>(std::move(sink));
+	}
+
+private:
+	template <std::size_t I, class Sink>
+	auto bind_from(Sink sink) const
+	{
+		if constexpr (I == sizeof...(Stages))
+			return sink;
+		else
+			return std::get<I>(_stages).bind(bind_from<I + 1>(std::move(sink)));
+	}
+
+	It _first;
+	It _last;
+	std::tuple<Stages...> _stages;
+};
+
+template <class It>
+pipeline<It> source(It first, It last)
+{
+	return pipeline<It>(first, last, std::tuple<>());
+}
+
+template <class Range>
+auto source(Range& r)
+{
+	return source(std::begin(r), std::end(r));
+}
+
+template <class Pred>
+filter_stage<Pred> filter(Pred pred)
+{
+	return filter_stage<Pred>{ std::move(pred) };
+}
+
+template <class F>
+transform_stage<F> transform(F f)
+{
+	return transform_stage<F>{ std::move(f) };
+}
+
+template <class It, class... Stages, class Pred>
+auto operator|(const pipeline<It, Stages...>& p, filter_stage<Pred> s)
+{
+	return p.then(std::move(s));
+}
+
+template <class It, class... Stages, class F>
+auto operator|(const pipeline<It, Stages...>& p, transform_stage<F> s)
+{
+	return p.then(std::move(s));
+}
+
+namespace detail {
+
+// Folds the values that reach the end of p with step(acc, value), every
+// chunk from identity, and joins the chunk results with combine.
+template <class It, class... Stages, class T, class Step, class Combine>
+T fold(const pipeline<It, Stages...>& p, const T& identity, const Step& step, const Combine& combine)
+{
+	return parallel_reduce(p.begin(), p.end(), identity,
+		[&p, &step](It b, It e, const T& init) {
+			T acc = init;
+			auto push = p.bind([&acc, &step](auto&& v) { acc = step(acc, std::forward<decltype(v)>(v)); });
+			for (; b != e; ++b)
+				push(*b);
+			return acc;
+		},
+		combine);
+}
+
+} // namespace detail
+
+// Terminal: folds the values that reach it with the associative op,
+// starting every chunk from identity.
+template <class T, class Op>
+struct reduce_terminal
+{
+	T identity;
+	Op op;
+};
+
+template <class T, class Op>
+reduce_terminal<T, Op> reduce(T identity, Op op)
+{
+	return reduce_terminal<T, Op>{ std::move(identity), std::move(op) };
+}
+
+template <class It, class... Stages, class T, class Op>
+T operator|(const pipeline<It, Stages...>& p, const reduce_terminal<T, Op>& r)
+{
+	return detail::fold(p, r.identity, r.op, r.op);
+}
+
+// Terminal: the number of values that reach it.
+struct count_terminal
+{
+};
+
+inline count_terminal count()
+{
+	return count_terminal();
+}
+
+template <class It, class... Stages>
+std::size_t operator|(const pipeline<It, Stages...>& p, count_terminal)
+{
+	return detail::fold(p, std::size_t(0), [](std::size_t n, const auto&) { return n + 1; },
+		std::plus<std::size_t>());
+}
+
+// Terminal: calls f on every value that reaches it, in no particular
+// order and from several workers at once.
+template <class F>
+struct for_each_terminal
+{
+	F f;
+};
+
+template <class F>
+for_each_terminal<F> for_each(F f)
+{
+	return for_each_terminal<F>{ std::move(f) };
+}
+
+template <class It, class... Stages, class F>
+void operator|(const pipeline<It, Stages...>& p, const for_each_terminal<F>& t)
+{
+	struct none
+	{
+	};
+	detail::fold(p, none(), [&t](none, auto&& v) { t.f(std::forward<decltype(v)>(v)); return none(); },
+		[](none, none) { return none(); });
+}
+
+} // namespace pipe
+} // namespace dx
@@ -0,0 +1,23 @@
+// platform.h
+// The few Windows names the samples use, for building them elsewhere.
+#pragma once
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <chrono>
+#include <cstdint>
+
+typedef std::int64_t __int64;
+
+// Milliseconds since an unspecified start point, like the Win32 calls.
+inline std::uint64_t GetTickCount64()
+{
+	using namespace std::chrono;
+	return std::uint64_t(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+inline std::uint32_t GetTickCount()
+{
+	return std::uint32_t(GetTickCount64());
+}
+#endif
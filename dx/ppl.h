@@ -0,0 +1,268 @@
+// ppl.h
+// Parallel algorithms with the call shapes of the PPL ones in <ppl.h>,
+// running on the work-stealing scheduler in scheduler.h.
+#pragma once
+#include "scheduler.h"
+#include "simd_reduce.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dx {
+
+namespace detail {
+
+template <class It>
+struct is_random_access
+	: std::is_base_of<std::random_access_iterator_tag,
+	typename std::iterator_traits<It>::iterator_category>
+{
+};
+
+// Iterators known to address contiguous storage.
+template <class It>
+struct is_contiguous
+	: std::integral_constant<bool, std::is_pointer<It>::value
+	|| std::is_same<It, typename std::vector<typename std::iterator_traits<It>::value_type>::iterator>::value
+	|| std::is_same<It, typename std::vector<typename std::iterator_traits<It>::value_type>::const_iterator>::value>
+{
+};
+
+template <class Fn, class T>
+struct is_plus : std::integral_constant<bool,
+	std::is_same<Fn, std::plus<T>>::value || std::is_same<Fn, std::plus<>>::value>
+{
+};
+
+// Whether parallel_reduce(first, last, identity, sym_fun) can sum chunks
+// with simd_sum: contiguous elements the kernels know, summed with
+// std::plus into an arithmetic T (an integral T only from integers, as
+// accumulate would truncate every step otherwise).
+template <class It, class T, class SymFn, class E = typename simd_element<
+	typename std::remove_cv<typename std::iterator_traits<It>::value_type>::type>::type>
+struct uses_simd_sum : std::integral_constant<bool, is_contiguous<It>::value && !std::is_void<E>::value
+	&& is_plus<SymFn, T>::value && std::is_arithmetic<T>::value
+	&& (std::is_floating_point<T>::value || std::is_integral<E>::value)>
+{
+};
+
+// Chunk size that gives every worker several pieces to balance over.
+inline std::size_t auto_grain(std::size_t n)
+{
+	std::size_t p = scheduler::instance().concurrency();
+	if (p == 1)
+		return n ? n : 1;
+	std::size_t g = n / (p * 8);
+	return g ? g : 1;
+}
+
+// Splits [lo, hi) in halves until a piece is at most grain long, then calls
+// body(lo, hi) on it. The right halves are spawned, the left ones recursed.
+template <class Body>
+void for_range(std::size_t lo, std::size_t hi, std::size_t grain, const Body& body)
+{
+	if (hi - lo > grain)
+	{
+		std::size_t mid = lo + (hi - lo) / 2;
+		structured_task_group g;
+		auto right = make_task([=, &body] { for_range(mid, hi, grain, body); });
+		g.run(right);
+		g.run_and_wait([=, &body] { for_range(lo, mid, grain, body); });
+	}
+	else if (hi > lo)
+	{
+		body(lo, hi);
+	}
+}
+
+template <class It, class T, class RangeFn, class SymFn>
+T reduce_range(It first, std::size_t lo, std::size_t hi, std::size_t grain,
+	const T& identity, const RangeFn& range_fun, const SymFn& sym_fun)
+{
+	if (hi - lo > grain)
+	{
+		std::size_t mid = lo + (hi - lo) / 2;
+		T left = identity, right = identity;
+		structured_task_group g;
+		auto task = make_task([&] {
+			right = reduce_range(first, mid, hi, grain, identity, range_fun, sym_fun);
+		});
+		g.run(task);
+		g.run_and_wait([&] {
+			left = reduce_range(first, lo, mid, grain, identity, range_fun, sym_fun);
+		});
+		return sym_fun(left, right);
+	}
+	return range_fun(first + lo, first + hi, identity);
+}
+
+template <class G, class F0>
+void invoke_spawn(G& g, const F0& f0)
+{
+	g.run_and_wait(f0);
+}
+
+template <class G, class F0, class F, class... Fs>
+void invoke_spawn(G& g, const F0& f0, const F& f, const Fs&... fs)
+{
+	auto call = [&f] { f(); };
+	task_handle<decltype(call)> h(call);
+	g.run(h);
+	invoke_spawn(g, f0, fs...);
+}
+
+} // namespace detail
+
+// Executes the functions in parallel and returns when all have finished.
+// The first one runs on the calling thread.
+template <class F1, class F2, class... Fs>
+void parallel_invoke(const F1& f1, const F2& f2, const Fs&... fs)
+{
+	structured_task_group g;
+	detail::invoke_spawn(g, f1, f2, fs...);
+}
+
+// Calls f(i) for first <= i < last, stepping by step.
+template <class Index, class F>
+void parallel_for(Index first, Index last, Index step, const F& f)
+{
+	if (!(first < last) || step <= Index(0))
+		return;
+	std::size_t n = std::size_t((last - first + step - 1) / step);
+	const std::atomic<bool>* cancel = detail::current_cancel_flag();
+	detail::for_range(0, n, detail::auto_grain(n), [&](std::size_t lo, std::size_t hi) {
+		for (std::size_t i = lo; i < hi; ++i)
+		{
+			if (cancel && cancel->load(std::memory_order_relaxed))
+				return;
+			f(Index(first + Index(i) * step));
+		}
+	});
+}
+
+template <class Index, class F>
+void parallel_for(Index first, Index last, const F& f)
+{
+	parallel_for(first, last, Index(1), f);
+}
+
+// Calls f(*it) for every element of [first, last).
+template <class It, class F>
+void parallel_for_each(It first, It last, const F& f)
+{
+	if constexpr (detail::is_random_access<It>::value)
+	{
+		std::size_t n = std::size_t(std::distance(first, last));
+		const std::atomic<bool>* cancel = detail::current_cancel_flag();
+		detail::for_range(0, n, detail::auto_grain(n), [&](std::size_t lo, std::size_t hi) {
+			It it = std::next(first, lo);
+			for (std::size_t i = lo; i < hi; ++i, ++it)
+			{
+				if (cancel && cancel->load(std::memory_order_relaxed))
+					return;
+				f(*it);
+			}
+		});
+	}
+	else
+	{
+		std::vector<It> items;
+		for (; first != last; ++first)
+			items.push_back(first);
+		parallel_for_each(items.begin(), items.end(), [&f](It it) { f(*it); });
+	}
+}
+
+// Parallel std::transform, unary form.
+template <class InIt, class OutIt, class F>
+OutIt parallel_transform(InIt first, InIt last, OutIt result, const F& f)
+{
+	std::size_t n = std::size_t(std::distance(first, last));
+	if constexpr (!detail::is_random_access<InIt>::value || !detail::is_random_access<OutIt>::value)
+	{
+		return std::transform(first, last, result, f);
+	}
+	else
+	{
+		detail::for_range(0, n, detail::auto_grain(n), [&](std::size_t lo, std::size_t hi) {
+			std::transform(std::next(first, lo), std::next(first, hi), std::next(result, lo), f);
+		});
+		return std::next(result, n);
+	}
+}
+
+// Parallel std::transform, binary form.
+template <class InIt1, class InIt2, class OutIt, class F>
+OutIt parallel_transform(InIt1 first1, InIt1 last1, InIt2 first2, OutIt result, const F& f)
+{
+	std::size_t n = std::size_t(std::distance(first1, last1));
+	if constexpr (!detail::is_random_access<InIt1>::value || !detail::is_random_access<InIt2>::value ||
+		!detail::is_random_access<OutIt>::value)
+	{
+		return std::transform(first1, last1, first2, result, f);
+	}
+	else
+	{
+		detail::for_range(0, n, detail::auto_grain(n), [&](std::size_t lo, std::size_t hi) {
+			std::transform(std::next(first1, lo), std::next(first1, hi),
+				std::next(first2, lo), std::next(result, lo), f);
+		});
+		return std::next(result, n);
+	}
+}
+
+// Reduces each chunk with range_fun(chunk_first, chunk_last, identity) and
+// combines the chunk results with the associative sym_fun.
+template <class It, class T, class RangeFn, class SymFn>
+T parallel_reduce(It first, It last, const T& identity,
+	const RangeFn& range_fun, const SymFn& sym_fun)
+{
+	if constexpr (!detail::is_random_access<It>::value)
+	{
+		return range_fun(first, last, identity);
+	}
+	else
+	{
+		std::size_t n = std::size_t(std::distance(first, last));
+		if (n == 0)
+			return identity;
+		return detail::reduce_range(first, 0, n, detail::auto_grain(n), identity, range_fun, sym_fun);
+	}
+}
+
+// Sums of int32/int64/float/double over contiguous storage run on the
+// vectorized kernels of simd_reduce.h, which widen as they add.
+template <class It, class T, class SymFn>
+T parallel_reduce(It first, It last, const T& identity, const SymFn& sym_fun)
+{
+	if constexpr (detail::uses_simd_sum<It, T, SymFn>::value)
+	{
+		return parallel_reduce(first, last, identity,
+			[](It b, It e, const T& init) {
+				return b == e ? init : T(init + simd_sum(std::addressof(*b), std::size_t(e - b)));
+			},
+			sym_fun);
+	}
+	else
+	{
+		return parallel_reduce(first, last, identity,
+			[&sym_fun](It b, It e, const T& init) { return std::accumulate(b, e, init, sym_fun); },
+			sym_fun);
+	}
+}
+
+template <class It, class T>
+T parallel_reduce(It first, It last, const T& identity)
+{
+	return parallel_reduce(first, last, identity, std::plus<T>());
+}
+
+} // namespace dx
+
+#include "combinable.h"
+#include "parallel_sort.h"
@@ -0,0 +1,405 @@
+// scan.h
+// parallel_inclusive_scan and parallel_exclusive_scan, the parallel
+// std::inclusive_scan / std::exclusive_scan.
+//
+// Two-level blocked scan (reduce, then scan): the input is cut into a few
+// blocks per worker, every block is reduced in parallel, the block totals
+// are scanned serially into the carry each block starts from, and every
+// block is then scanned in parallel from its carry. That reads the input
+// twice and writes the output once; the serial step is one element per
+// block. op must be associative; it need not be commutative, as blocks are
+// only ever combined left to right. The output may be the input (in-place
+// scan). Inputs and outputs that are not random access, and a single
+// worker, get the serial loop.
+//
+// Sums with std::plus of contiguous 32/64-bit integers, floats or doubles
+// run on an AVX2 kernel that scans eight or four elements in a register
+// with shifts and adds, carrying the last lane into the next register, and
+// on simd_sum for the block totals. Floating-point sums are then
+// associated differently from a serial loop, as in any parallel scan.
+#pragma once
+#include "ppl.h"
+#include "cpu_features.h"
+#include "simd_reduce.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace dx {
+
+namespace detail {
+
+// Kernel element type of a scanned T, or void. Integers are scanned as
+// unsigned: sums wrap the same for either sign, without undefined overflow.
+template <class T, class = void>
+struct scan_element
+{
+	typedef void type;
+};
+
+template <class T>
+struct scan_element<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value
+	&& (sizeof(T) == 4 || sizeof(T) == 8)>::type>
+{
+	typedef typename std::conditional<sizeof(T) == 4, std::uint32_t, std::uint64_t>::type type;
+};
+
+template <>
+struct scan_element<float>
+{
+	typedef float type;
+};
+
+template <>
+struct scan_element<double>
+{
+	typedef double type;
+};
+
+namespace scalar_kernels {
+
+// Inclusive (Exclusive: exclusive) running sum of in[0..n) from carry into
+// out; returns the carry after the last element.
+template <class E, bool Exclusive>
+E scan_sum(const E* in, E* out, std::size_t n, E carry)
+{
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		E v = in[i];
+		if (Exclusive)
+			out[i] = carry;
+		carry += v;
+		if (!Exclusive)
+			out[i] = carry;
+	}
+	return carry;
+}
+
+} // namespace scalar_kernels
+
+#ifdef DX_X86_SIMD
+
+namespace avx2_kernels {
+
+// One register of E: prefix() turns lanes x0, x1, ... into x0, x0 + x1,
+// ... ; shift_in(x, c) moves every lane up by one and puts lane 0 of c in
+// lane 0; last() broadcasts the highest lane.
+template <class E>
+struct scan_ops;
+
+template <>
+struct scan_ops<std::uint32_t>
+{
+	typedef __m256i V;
+	enum { lanes = 8 };
+	DX_TARGET_AVX2 static V load(const std::uint32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	DX_TARGET_AVX2 static void store(std::uint32_t* p, V v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	DX_TARGET_AVX2 static V set1(std::uint32_t v) { return _mm256_set1_epi32(int(v)); }
+	DX_TARGET_AVX2 static V add(V a, V b) { return _mm256_add_epi32(a, b); }
+	DX_TARGET_AVX2 static V prefix(V x)
+	{
+		x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+		x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+		// Lane 3 of the low half into every lane of the high half.
+		const __m256i low = _mm256_permute2x128_si256(x, x, 0x08);
+		return _mm256_add_epi32(x, _mm256_shuffle_epi32(low, 0xff));
+	}
+	DX_TARGET_AVX2 static V shift_in(V x, V c)
+	{
+		const __m256i up = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6));
+		return _mm256_blend_epi32(up, c, 0x01);
+	}
+	DX_TARGET_AVX2 static V last(V x) { return _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(7)); }
+	DX_TARGET_AVX2 static std::uint32_t first(V x) { return std::uint32_t(_mm256_cvtsi256_si32(x)); }
+};
+
+template <>
+struct scan_ops<std::uint64_t>
+{
+	typedef __m256i V;
+	enum { lanes = 4 };
+	DX_TARGET_AVX2 static V load(const std::uint64_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	DX_TARGET_AVX2 static void store(std::uint64_t* p, V v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	DX_TARGET_AVX2 static V set1(std::uint64_t v) { return _mm256_set1_epi64x((long long)v); }
+	DX_TARGET_AVX2 static V add(V a, V b) { return _mm256_add_epi64(a, b); }
+	DX_TARGET_AVX2 static V prefix(V x)
+	{
+		x = _mm256_add_epi64(x, _mm256_slli_si256(x, 8));
+		// Lane 1 into lanes 2 and 3.
+		const __m256i low = _mm256_permute4x64_epi64(x, 0x55);
+		return _mm256_add_epi64(x, _mm256_blend_epi32(_mm256_setzero_si256(), low, 0xf0));
+	}
+	DX_TARGET_AVX2 static V shift_in(V x, V c)
+	{
+		return _mm256_blend_epi32(_mm256_permute4x64_epi64(x, 0x93), c, 0x03);
+	}
+	DX_TARGET_AVX2 static V last(V x) { return _mm256_permute4x64_epi64(x, 0xff); }
+	DX_TARGET_AVX2 static std::uint64_t first(V x) { return std::uint64_t(_mm256_extract_epi64(x, 0)); }
+};
+
+template <>
+struct scan_ops<float>
+{
+	typedef __m256 V;
+	enum { lanes = 8 };
+	DX_TARGET_AVX2 static V load(const float* p) { return _mm256_loadu_ps(p); }
+	DX_TARGET_AVX2 static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+	DX_TARGET_AVX2 static V set1(float v) { return _mm256_set1_ps(v); }
+	DX_TARGET_AVX2 static V add(V a, V b) { return _mm256_add_ps(a, b); }
+	DX_TARGET_AVX2 static V prefix(V x)
+	{
+		x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 4)));
+		x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+		const __m256 low = _mm256_permute2f128_ps(x, x, 0x08);
+		return _mm256_add_ps(x, _mm256_permute_ps(low, 0xff));
+	}
+	DX_TARGET_AVX2 static V shift_in(V x, V c)
+	{
+		const __m256 up = _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6));
+		return _mm256_blend_ps(up, c, 0x01);
+	}
+	DX_TARGET_AVX2 static V last(V x) { return _mm256_permutevar8x32_ps(x, _mm256_set1_epi32(7)); }
+	DX_TARGET_AVX2 static float first(V x) { return _mm256_cvtss_f32(x); }
+};
+
+template <>
+struct scan_ops<double>
+{
+	typedef __m256d V;
+	enum { lanes = 4 };
+	DX_TARGET_AVX2 static V load(const double* p) { return _mm256_loadu_pd(p); }
+	DX_TARGET_AVX2 static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+	DX_TARGET_AVX2 static V set1(double v) { return _mm256_set1_pd(v); }
+	DX_TARGET_AVX2 static V add(V a, V b) { return _mm256_add_pd(a, b); }
+	DX_TARGET_AVX2 static V prefix(V x)
+	{
+		x = _mm256_add_pd(x, _mm256_castsi256_pd(_mm256_slli_si256(_mm256_castpd_si256(x), 8)));
+		const __m256d low = _mm256_permute4x64_pd(x, 0x55);
+		return _mm256_add_pd(x, _mm256_blend_pd(_mm256_setzero_pd(), low, 0x0c));
+	}
+	DX_TARGET_AVX2 static V shift_in(V x, V c)
+	{
+		return _mm256_blend_pd(_mm256_permute4x64_pd(x, 0x93), c, 0x01);
+	}
+	DX_TARGET_AVX2 static V last(V x) { return _mm256_permute4x64_pd(x, 0xff); }
+	DX_TARGET_AVX2 static double first(V x) { return _mm256_cvtsd_f64(x); }
+};
+
+template <class E, bool Exclusive>
+DX_TARGET_AVX2 E scan_sum(const E* in, E* out, std::size_t n, E carry)
+{
+	typedef scan_ops<E> O;
+	typename O::V c = O::set1(carry);
+	std::size_t i = 0;
+	for (; i + O::lanes <= n; i += O::lanes)
+	{
+		typename O::V x = O::add(O::prefix(O::load(in + i)), c);
+		O::store(out + i, Exclusive ? O::shift_in(x, c) : x);
+		c = O::last(x);
+	}
+	return scalar_kernels::scan_sum<E, Exclusive>(in + i, out + i, n - i, O::first(c));
+}
+
+} // namespace avx2_kernels
+
+#endif // DX_X86_SIMD
+
+template <class E>
+struct scan_kernels
+{
+	E (*inclusive)(const E*, E*, std::size_t, E);
+	E (*exclusive)(const E*, E*, std::size_t, E);
+};
+
+template <class E>
+const scan_kernels<E>& select_scan_kernels()
+{
+	static const scan_kernels<E> k = [] {
+#ifdef DX_X86_SIMD
+		if (cpu_simd_level() >= simd_level::avx2)
+			return scan_kernels<E>{ &avx2_kernels::scan_sum<E, false>, &avx2_kernels::scan_sum<E, true> };
+#endif
+		return scan_kernels<E>{ &scalar_kernels::scan_sum<E, false>, &scalar_kernels::scan_sum<E, true> };
+	}();
+	return k;
+}
+
+// Whether a scan of InIt into OutIt with op from a T can run on the sum
+// kernels: contiguous storage of one kernel type on both sides, std::plus,
+// and a T of that type.
+template <class InIt, class OutIt, class T, class Op,
+	class V = typename std::remove_cv<typename std::iterator_traits<InIt>::value_type>::type>
+struct uses_simd_scan : std::integral_constant<bool, is_contiguous<InIt>::value && is_contiguous<OutIt>::value
+	&& std::is_same<V, typename std::remove_cv<typename std::iterator_traits<OutIt>::value_type>::type>::value
+	&& std::is_same<V, T>::value && is_plus<Op, T>::value && !std::is_void<typename scan_element<V>::type>::value>
+{
+};
+
+// Scans n elements of a contiguous run from carry; returns the carry after.
+template <bool Exclusive, class InIt, class OutIt, class T>
+T simd_scan_block(InIt in, OutIt out, std::size_t n, T carry)
+{
+	typedef typename scan_element<T>::type E;
+	if (n == 0)
+		return carry;
+	const E* p = reinterpret_cast<const E*>(std::addressof(*in));
+	E* q = reinterpret_cast<E*>(std::addressof(*out));
+	const scan_kernels<E>& k = select_scan_kernels<E>();
+	E c = Exclusive ? k.exclusive(p, q, n, E(carry)) : k.inclusive(p, q, n, E(carry));
+	T r;
+	std::memcpy(&r, &c, sizeof(r));
+	return r;
+}
+
+// Total of the n >= 1 elements of a block, for the carries, folded in the
+// scan's T. op need not have an identity, so the fold starts from the
+// first element.
+template <class T, class InIt, class Op,
+	class V = typename std::remove_cv<typename std::iterator_traits<InIt>::value_type>::type>
+T reduce_block(InIt in, std::size_t n, const Op& op)
+{
+	if constexpr (is_contiguous<InIt>::value && std::is_same<V, T>::value && is_plus<Op, T>::value
+		&& !std::is_void<typename scan_element<T>::type>::value)
+	{
+		if constexpr (std::is_integral<T>::value)
+		{
+			// Wrapping sum; simd_sum widens 32-bit values, which agrees
+			// modulo 2^32.
+			typedef typename std::make_signed<T>::type S;
+			const S* p = reinterpret_cast<const S*>(std::addressof(*in));
+			return T(simd_sum(p, n));
+		}
+		else
+		{
+			return T(simd_sum(std::addressof(*in), n));
+		}
+	}
+	else
+	{
+		T total = T(*in);
+		for (std::size_t i = 1; i < n; ++i)
+			total = op(total, *++in);
+		return total;
+	}
+}
+
+// Generic block scan from carry; returns the carry after.
+template <bool Exclusive, class InIt, class OutIt, class T, class Op>
+T scan_block(InIt in, OutIt out, std::size_t n, T carry, const Op& op)
+{
+	if constexpr (uses_simd_scan<InIt, OutIt, T, Op>::value)
+	{
+		return simd_scan_block<Exclusive>(in, out, n, carry);
+	}
+	else
+	{
+		for (std::size_t i = 0; i < n; ++i, ++in, ++out)
+		{
+			T v = *in;
+			if (Exclusive)
+				*out = carry;
+			carry = op(carry, v);
+			if (!Exclusive)
+				*out = carry;
+		}
+		return carry;
+	}
+}
+
+// The scan, from init. Blocks are about a quarter of auto_grain so that
+// every worker has several to balance over, but no smaller than 16K
+// elements, under which the serial step and the task overhead dominate.
+template <bool Exclusive, class InIt, class OutIt, class T, class Op>
+OutIt scan(InIt first, InIt last, OutIt result, T init, const Op& op)
+{
+	if constexpr (!is_random_access<InIt>::value || !is_random_access<OutIt>::value)
+	{
+		for (; first != last; ++first, ++result)
+		{
+			T v = *first;
+			if (Exclusive)
+				*result = init;
+			init = op(init, v);
+			if (!Exclusive)
+				*result = init;
+		}
+		return result;
+	}
+	else
+	{
+		const std::size_t n = std::size_t(std::distance(first, last));
+		const std::size_t p = scheduler::instance().concurrency();
+		const std::size_t min_block = 16 * 1024;
+		if (p == 1 || n <= min_block)
+		{
+			scan_block<Exclusive>(first, result, n, init, op);
+			return std::next(result, n);
+		}
+		std::size_t block = n / (4 * p);
+		if (block < min_block)
+			block = min_block;
+		const std::size_t blocks = (n + block - 1) / block;
+
+		// The last block's total is never needed.
+		std::vector<T> carry(blocks, init);
+		parallel_for(std::size_t(0), blocks - 1, [&](std::size_t b) {
+			carry[b + 1] = reduce_block<T>(std::next(first, b * block), block, op);
+		});
+		for (std::size_t b = 1; b < blocks; ++b)
+			carry[b] = op(carry[b - 1], carry[b]);
+
+		parallel_for(std::size_t(0), blocks, [&](std::size_t b) {
+			std::size_t lo = b * block, len = (std::min)(block, n - lo);
+			scan_block<Exclusive>(std::next(first, lo), std::next(result, lo), len, carry[b], op);
+		});
+		return std::next(result, n);
+	}
+}
+
+} // namespace detail
+
+// result[i] = init op first[0] op ... op first[i]. result may be first.
+template <class InIt, class OutIt, class T, class Op>
+OutIt parallel_inclusive_scan(InIt first, InIt last, OutIt result, const Op& op, T init)
+{
+	return detail::scan<false>(first, last, result, init, op);
+}
+
+// result[i] = first[0] op ... op first[i].
+template <class InIt, class OutIt, class Op>
+OutIt parallel_inclusive_scan(InIt first, InIt last, OutIt result, const Op& op)
+{
+	typedef typename std::iterator_traits<InIt>::value_type T;
+	if (first == last)
+		return result;
+	T head = *first;
+	*result = head;
+	return detail::scan<false>(std::next(first), last, std::next(result), head, op);
+}
+
+template <class InIt, class OutIt>
+OutIt parallel_inclusive_scan(InIt first, InIt last, OutIt result)
+{
+	return parallel_inclusive_scan(first, last, result, std::plus<>());
+}
+
+// result[i] = init op first[0] op ... op first[i - 1], result[0] = init.
+// result may be first.
+template <class InIt, class OutIt, class T, class Op>
+OutIt parallel_exclusive_scan(InIt first, InIt last, OutIt result, T init, const Op& op)
+{
+	return detail::scan<true>(first, last, result, init, op);
+}
+
+template <class InIt, class OutIt, class T>
+OutIt parallel_exclusive_scan(InIt first, InIt last, OutIt result, T init)
+{
+	return parallel_exclusive_scan(first, last, result, init, std::plus<>());
+}
+
+} // namespace dx
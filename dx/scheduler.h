@@ -0,0 +1,636 @@
+// scheduler.h
+// Portable work-stealing scheduler.
+//
+// A fixed pool of worker threads, one Chase-Lev deque per worker. Spawned
+// work goes to the bottom of the spawning thread's own deque; idle workers
+// steal from the top of a random victim. A thread that waits for a group
+// keeps executing work instead of blocking, so nested fork/join (for
+// example the recursive parallel_invoke in parallel_bitonic_sort.cpp) never
+// needs more threads than the pool has and cannot deadlock.
+//
+// Threads that are not workers (main, or threads of the application) claim
+// one of a few external slots on first use, so they can spawn and help like
+// a worker. When all external slots are taken the thread falls back to a
+// shared injection queue.
+//
+// The number of workers defaults to std::thread::hardware_concurrency() and
+// can be overridden with the DX_NUM_THREADS environment variable. The calling
+// thread counts as one of them. set_concurrency() parks workers above a
+// limit without destroying them, for measuring how work scales with the
+// number of threads.
+#pragma once
+#include "ws_deque.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DX_CPU_RELAX() _mm_pause()
+#else
+#define DX_CPU_RELAX() ((void)0)
+#endif
+
+namespace dx {
+
+// Unit of work executed by the scheduler.
+class work_item
+{
+public:
+	virtual ~work_item() {}
+	virtual void execute() = 0;
+};
+
+class scheduler
+{
+	struct alignas(64) slot
+	{
+		detail::ws_deque<work_item> deque;
+		std::atomic<bool> claimed;
+		slot() : claimed(false) {}
+	};
+
+	// Per-thread binding to a slot of a scheduler.
+	struct binding
+	{
+		scheduler* owner = nullptr;
+		int index = -1;
+		std::uint32_t seed = 0;
+		~binding()
+		{
+			if (owner && index >= 0 && unsigned(index) >= owner->_num_workers)
+				owner->_slots[index]->claimed.store(false, std::memory_order_release);
+		}
+	};
+
+	static binding& this_thread()
+	{
+		static thread_local binding b;
+		return b;
+	}
+
+public:
+	// Slots reserved for threads that are not workers.
+	static const unsigned external_slots = 8;
+
+	explicit scheduler(unsigned concurrency)
+		: _num_workers(concurrency > 1 ? concurrency - 1 : 0), _active_workers(_num_workers),
+		_inject_size(0), _sleepers(0), _epoch(0), _stop(false)
+	{
+		for (unsigned i = 0; i < _num_workers + external_slots; ++i)
+			_slots.emplace_back(new slot);
+		for (unsigned i = 0; i < _num_workers; ++i)
+			_threads.emplace_back([this, i] { worker_main(i); });
+	}
+
+	~scheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_sleep_mutex);
+			_stop.store(true);
+			_epoch.fetch_add(1);
+		}
+		_sleep_cv.notify_all();
+		_park_cv.notify_all();
+		for (auto& t : _threads)
+			t.join();
+	}
+
+	scheduler(const scheduler&) = delete;
+	scheduler& operator=(const scheduler&) = delete;
+
+	// The process-wide scheduler used by the parallel algorithms.
+	static scheduler& instance()
+	{
+		static scheduler s(default_concurrency());
+		return s;
+	}
+
+	static unsigned default_concurrency()
+	{
+		if (const char* env = std::getenv("DX_NUM_THREADS"))
+		{
+			int n = std::atoi(env);
+			if (n > 0)
+				return unsigned(n);
+		}
+		unsigned n = std::thread::hardware_concurrency();
+		return n ? n : 1;
+	}
+
+	// Number of threads that execute work, including the calling thread.
+	unsigned concurrency() const { return _active_workers.load(std::memory_order_relaxed) + 1; }
+
+	// Number of threads the pool was created with; the limit of set_concurrency().
+	unsigned max_concurrency() const { return _num_workers + 1; }
+
+	// Lets only the first n - 1 workers (plus the calling thread) take work;
+	// the others finish what they hold and park until the limit is raised.
+	// n is clamped to [1, max_concurrency()]. Call it between parallel
+	// algorithms, not while one is running.
+	void set_concurrency(unsigned n)
+	{
+		if (n < 1)
+			n = 1;
+		if (n > max_concurrency())
+			n = max_concurrency();
+		{
+			std::lock_guard<std::mutex> lock(_sleep_mutex);
+			_active_workers.store(n - 1);
+			_epoch.fetch_add(1);
+		}
+		_sleep_cv.notify_all();
+		_park_cv.notify_all();
+	}
+
+	// Upper bound (exclusive) of current_slot().
+	unsigned slot_count() const { return unsigned(_slots.size()); }
+
+	// Slot of the calling thread, or -1 if it could not get one.
+	int current_slot()
+	{
+		binding& b = this_thread();
+		if (b.owner == this)
+			return b.index;
+		if (b.owner == nullptr)
+		{
+			b.owner = this;
+			b.seed = std::uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+			for (unsigned i = _num_workers; i < _slots.size(); ++i)
+			{
+				bool expected = false;
+				if (_slots[i]->claimed.compare_exchange_strong(expected, true,
+					std::memory_order_acquire))
+				{
+					b.index = int(i);
+					break;
+				}
+			}
+			return b.index;
+		}
+		return -1;
+	}
+
+	// Makes a work item available to the pool. The item must stay alive
+	// until it has executed.
+	void spawn(work_item* w)
+	{
+		int s = current_slot();
+		if (s >= 0)
+		{
+			_slots[s]->deque.push(w);
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(_inject_mutex);
+			_inject.push_back(w);
+			_inject_size.fetch_add(1, std::memory_order_relaxed);
+		}
+		wake_one();
+	}
+
+	// Executes available work until done() returns true.
+	template <class Pred>
+	void wait_until(const Pred& done)
+	{
+		int s = current_slot();
+		unsigned idle = 0;
+		while (!done())
+		{
+			if (work_item* w = find_work(s))
+			{
+				w->execute();
+				idle = 0;
+			}
+			else if (++idle < 64)
+			{
+				DX_CPU_RELAX();
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+private:
+	void wake_one()
+	{
+		// Pairs with the fence in worker_main: either the sleeper sees the
+		// new work, or we see the sleeper.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_sleepers.load(std::memory_order_relaxed) > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_sleep_mutex);
+				_epoch.fetch_add(1, std::memory_order_relaxed);
+			}
+			_sleep_cv.notify_one();
+		}
+	}
+
+	std::uint32_t next_random()
+	{
+		// xorshift32
+		std::uint32_t& x = this_thread().seed;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return x;
+	}
+
+	work_item* find_work(int self)
+	{
+		if (self >= 0)
+		{
+			if (work_item* w = _slots[self]->deque.pop())
+				return w;
+		}
+		if (_inject_size.load(std::memory_order_relaxed) > 0)
+		{
+			std::lock_guard<std::mutex> lock(_inject_mutex);
+			if (!_inject.empty())
+			{
+				work_item* w = _inject.front();
+				_inject.pop_front();
+				_inject_size.fetch_sub(1, std::memory_order_relaxed);
+				return w;
+			}
+		}
+		std::size_t n = _slots.size();
+		std::size_t start = next_random() % n;
+		for (std::size_t k = 0; k < n; ++k)
+		{
+			std::size_t v = (start + k) % n;
+			if (int(v) == self)
+				continue;
+			if (work_item* w = _slots[v]->deque.steal())
+				return w;
+		}
+		return nullptr;
+	}
+
+	bool has_work() const
+	{
+		if (_inject_size.load(std::memory_order_relaxed) > 0)
+			return true;
+		for (auto& s : _slots)
+		{
+			if (!s->deque.empty())
+				return true;
+		}
+		return false;
+	}
+
+	void worker_main(unsigned index)
+	{
+		binding& b = this_thread();
+		b.owner = this;
+		b.index = int(index);
+		b.seed = (index + 1) * 2654435761u;
+#ifdef __linux__
+		// Names the worker in per-thread reports (perf_counters.h, top -H).
+		char name[16];
+		std::snprintf(name, sizeof(name), "dx-worker-%u", index);
+		pthread_setname_np(pthread_self(), name);
+#endif
+
+		for (;;)
+		{
+			if (index >= _active_workers.load(std::memory_order_relaxed))
+			{
+				if (!park(index))
+					return;
+				continue;
+			}
+			work_item* w = find_work(int(index));
+			for (int spin = 0; !w && spin < 256 && index < _active_workers.load(std::memory_order_relaxed); ++spin)
+			{
+				if (_stop.load(std::memory_order_relaxed))
+					return;
+				std::this_thread::yield();
+				w = find_work(int(index));
+			}
+			if (w)
+			{
+				w->execute();
+				continue;
+			}
+
+			std::uint64_t epoch = _epoch.load();
+			_sleepers.fetch_add(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!has_work())
+			{
+				std::unique_lock<std::mutex> lock(_sleep_mutex);
+				while (_epoch.load(std::memory_order_relaxed) == epoch && !_stop.load()
+					&& index < _active_workers.load(std::memory_order_relaxed))
+					_sleep_cv.wait(lock);
+			}
+			_sleepers.fetch_sub(1);
+			if (_stop.load())
+				return;
+		}
+	}
+
+	// Runs what is left in the worker's own deque, then sleeps until the
+	// worker is inside the concurrency limit again. False on shutdown.
+	bool park(unsigned index)
+	{
+		while (work_item* w = _slots[index]->deque.pop())
+			w->execute();
+		std::unique_lock<std::mutex> lock(_sleep_mutex);
+		while (!_stop.load() && index >= _active_workers.load(std::memory_order_relaxed))
+			_park_cv.wait(lock);
+		return !_stop.load();
+	}
+
+	const unsigned _num_workers;
+	std::atomic<unsigned> _active_workers;
+	std::vector<std::unique_ptr<slot>> _slots;
+	std::vector<std::thread> _threads;
+
+	std::mutex _inject_mutex;
+	std::deque<work_item*> _inject;
+	std::atomic<std::size_t> _inject_size;
+
+	std::mutex _sleep_mutex;
+	std::condition_variable _sleep_cv;
+	std::condition_variable _park_cv;
+	std::atomic<int> _sleepers;
+	std::atomic<std::uint64_t> _epoch;
+	std::atomic<bool> _stop;
+};
+
+namespace detail {
+
+// Cancellation flag that algorithms started on this thread observe.
+inline const std::atomic<bool>*& current_cancel_flag()
+{
+	static thread_local const std::atomic<bool>* flag = nullptr;
+	return flag;
+}
+
+// Installs a cancellation flag for the lifetime of the scope.
+class cancel_scope
+{
+public:
+	explicit cancel_scope(const std::atomic<bool>* flag)
+		: _saved(current_cancel_flag())
+	{
+		current_cancel_flag() = flag;
+	}
+	~cancel_scope() { current_cancel_flag() = _saved; }
+
+private:
+	const std::atomic<bool>* _saved;
+};
+
+// Completion count and first exception of a group of spawned work.
+class group_state
+{
+public:
+	group_state()
+		: pending(0), canceled(false), failed(false), cancel_flag(current_cancel_flag())
+	{
+	}
+
+	bool is_canceling() const
+	{
+		return canceled.load(std::memory_order_relaxed) ||
+			(cancel_flag && cancel_flag->load(std::memory_order_relaxed));
+	}
+
+	void fail(std::exception_ptr e)
+	{
+		bool expected = false;
+		if (failed.compare_exchange_strong(expected, true))
+			error = e;
+		canceled.store(true, std::memory_order_relaxed);
+	}
+
+	void wait()
+	{
+		scheduler::instance().wait_until([this] {
+			return pending.load(std::memory_order_acquire) == 0;
+		});
+		if (failed.load(std::memory_order_acquire))
+		{
+			std::exception_ptr e = error;
+			error = nullptr;
+			failed.store(false);
+			canceled.store(false);
+			std::rethrow_exception(e);
+		}
+	}
+
+	template <class F>
+	void invoke(const F& f)
+	{
+		cancel_scope scope(cancel_flag);
+		if (is_canceling())
+			return;
+		try
+		{
+			f();
+		}
+		catch (...)
+		{
+			fail(std::current_exception());
+		}
+	}
+
+	std::atomic<long> pending;
+	std::atomic<bool> canceled;
+	std::atomic<bool> failed;
+	std::exception_ptr error;
+	const std::atomic<bool>* cancel_flag;
+};
+
+} // namespace detail
+
+class structured_task_group;
+
+// A function bound to a structured_task_group; lives on the caller's stack.
+template <class F>
+class task_handle : public work_item
+{
+public:
+	explicit task_handle(const F& f) : _f(f), _group(nullptr) {}
+
+	void execute() override
+	{
+		detail::group_state* g = _group;
+		g->invoke(_f);
+		// Last touch: the owner may destroy this handle right after.
+		g->pending.fetch_sub(1, std::memory_order_release);
+	}
+
+private:
+	friend class structured_task_group;
+	F _f;
+	detail::group_state* _group;
+};
+
+template <class F>
+task_handle<F> make_task(const F& f)
+{
+	return task_handle<F>(f);
+}
+
+// Fork/join group whose task handles are owned by the caller. wait() must
+// be called before the handles go out of scope.
+class structured_task_group
+{
+public:
+	structured_task_group() {}
+	~structured_task_group() {}
+
+	template <class F>
+	void run(task_handle<F>& h)
+	{
+		h._group = &_state;
+		_state.pending.fetch_add(1, std::memory_order_relaxed);
+		scheduler::instance().spawn(&h);
+	}
+
+	// Waits for all handles; rethrows the first exception any of them threw.
+	void wait() { _state.wait(); }
+
+	// Runs f on the calling thread, then waits.
+	template <class F>
+	void run_and_wait(const F& f)
+	{
+		_state.invoke(f);
+		wait();
+	}
+
+	void cancel() { _state.canceled.store(true, std::memory_order_relaxed); }
+	bool is_canceling() const { return _state.is_canceling(); }
+
+private:
+	detail::group_state _state;
+};
+
+// Fork/join group that owns copies of the functions it runs.
+class task_group
+{
+	template <class F>
+	class item : public work_item
+	{
+	public:
+		item(const F& f, detail::group_state* g) : _f(f), _group(g) {}
+
+		void execute() override
+		{
+			detail::group_state* g = _group;
+			g->invoke(_f);
+			delete this;
+			g->pending.fetch_sub(1, std::memory_order_release);
+		}
+
+	private:
+		F _f;
+		detail::group_state* _group;
+	};
+
+public:
+	task_group() {}
+	~task_group()
+	{
+		// Items reference _state, so they must finish before it goes away.
+		if (_state.pending.load() != 0)
+		{
+			try { _state.wait(); }
+			catch (...) {}
+		}
+	}
+
+	template <class F>
+	void run(const F& f)
+	{
+		_state.pending.fetch_add(1, std::memory_order_relaxed);
+		scheduler::instance().spawn(new item<F>(f, &_state));
+	}
+
+	void wait() { _state.wait(); }
+
+	template <class F>
+	void run_and_wait(const F& f)
+	{
+		_state.invoke(f);
+		wait();
+	}
+
+	void cancel() { _state.canceled.store(true, std::memory_order_relaxed); }
+	bool is_canceling() const { return _state.is_canceling(); }
+
+private:
+	detail::group_state _state;
+};
+
+class cancellation_token_source;
+
+// Read side of a cancellation_token_source.
+class cancellation_token
+{
+public:
+	cancellation_token() {}
+
+	static cancellation_token none() { return cancellation_token(); }
+
+	bool is_canceled() const
+	{
+		return _flag && _flag->load(std::memory_order_relaxed);
+	}
+
+	bool is_cancelable() const { return bool(_flag); }
+
+private:
+	friend class cancellation_token_source;
+	template <class F>
+	friend void run_with_cancellation_token(const F& f, cancellation_token ct);
+
+	explicit cancellation_token(std::shared_ptr<std::atomic<bool>> flag) : _flag(flag) {}
+
+	std::shared_ptr<std::atomic<bool>> _flag;
+};
+
+class cancellation_token_source
+{
+public:
+	cancellation_token_source() : _flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+	cancellation_token get_token() const { return cancellation_token(_flag); }
+	void cancel() const { _flag->store(true, std::memory_order_relaxed); }
+
+private:
+	std::shared_ptr<std::atomic<bool>> _flag;
+};
+
+// Runs f; parallel algorithms started inside it stop scheduling new
+// iterations once the token is canceled.
+template <class F>
+void run_with_cancellation_token(const F& f, cancellation_token ct)
+{
+	detail::cancel_scope scope(ct._flag.get());
+	f();
+}
+
+inline bool is_current_task_group_canceling()
+{
+	const std::atomic<bool>* flag = detail::current_cancel_flag();
+	return flag && flag->load(std::memory_order_relaxed);
+}
+
+} // namespace dx
@@ -0,0 +1,138 @@
+// sieve.h
+// Parallel cache-blocked segmented sieve of Eratosthenes.
+//
+// The range is cut into segments that fit in L1/L2; each worker sieves one
+// segment at a time in its own buffer using the base primes up to
+// sqrt(hi). Only odd numbers are stored, one byte each. Memory is the
+// base primes plus one segment per worker, i.e. O(sqrt(N)), no matter
+// how long the range is. Ranges may extend up to 2^32.
+#pragma once
+#include "ppl.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace dx {
+
+// Primes p <= limit, by a plain sieve (used for the base primes).
+inline std::vector<std::uint32_t> small_primes(std::uint32_t limit)
+{
+	std::vector<std::uint32_t> primes;
+	if (limit < 2)
+		return primes;
+	std::vector<std::uint8_t> composite(limit + 1, 0);
+	for (std::uint32_t i = 2; i <= limit; ++i)
+	{
+		if (composite[i])
+			continue;
+		primes.push_back(i);
+		for (std::uint64_t j = std::uint64_t(i) * i; j <= limit; j += i)
+			composite[j] = 1;
+	}
+	return primes;
+}
+
+namespace detail {
+
+// Odd numbers per segment: 32 KB of flags.
+const std::uint64_t sieve_segment_bytes = 32 * 1024;
+const std::uint64_t sieve_segment_span = 2 * sieve_segment_bytes;
+
+inline std::uint32_t isqrt(std::uint64_t n)
+{
+	std::uint64_t r = std::uint64_t(std::sqrt(double(n)));
+	while (r * r > n)
+		--r;
+	while ((r + 1) * (r + 1) <= n)
+		++r;
+	return std::uint32_t(r);
+}
+
+// Sieves [lo, hi) segment by segment in parallel. For each segment calls
+// visit(base, first, last, composite) where first/last clip the segment to
+// the range and composite[i] != 0 iff the odd number base + 2i + 1 is not
+// prime. Even numbers are left to the caller.
+template <class Visit>
+void sieve_segments(std::uint64_t lo, std::uint64_t hi, const Visit& visit)
+{
+	if (hi <= lo)
+		return;
+	const std::vector<std::uint32_t> primes = small_primes(isqrt(hi - 1));
+	const std::uint64_t first_base = lo / sieve_segment_span * sieve_segment_span;
+	const std::uint64_t segments = (hi - first_base + sieve_segment_span - 1) / sieve_segment_span;
+
+	combinable<std::vector<std::uint8_t>> buffers;
+	parallel_for(std::uint64_t(0), segments, [&](std::uint64_t s) {
+		std::vector<std::uint8_t>& composite = buffers.local();
+		composite.assign(sieve_segment_bytes, 0);
+
+		const std::uint64_t base = first_base + s * sieve_segment_span;
+		const std::uint64_t end = std::min(base + sieve_segment_span, hi);
+		for (std::size_t k = 1; k < primes.size(); ++k)
+		{
+			const std::uint64_t p = primes[k];
+			if (p * p >= end)
+				break;
+			// First odd multiple of p in the segment, but not below p*p.
+			std::uint64_t m = std::max(p * p, (base + p - 1) / p * p);
+			if ((m & 1) == 0)
+				m += p;
+			for (std::uint64_t i = (m - base - 1) / 2; i < sieve_segment_bytes; i += p)
+				composite[i] = 1;
+		}
+		if (base == 0)
+			composite[0] = 1; // 1 is not prime
+
+		visit(base, std::max(base, lo), end, composite.data());
+	});
+}
+
+} // namespace detail
+
+// Sum of the primes in [lo, hi).
+inline std::uint64_t prime_sum(std::uint64_t lo, std::uint64_t hi)
+{
+	combinable<std::uint64_t> sum;
+	detail::sieve_segments(lo, hi, [&](std::uint64_t base, std::uint64_t first,
+		std::uint64_t last, const std::uint8_t* composite) {
+		std::uint64_t s = 0;
+		for (std::uint64_t n = first | 1; n < last; n += 2)
+		{
+			if (!composite[(n - base) / 2])
+				s += n;
+		}
+		sum.local() += s;
+	});
+	return sum.combine(std::plus<std::uint64_t>()) + (lo <= 2 && 2 < hi ? 2 : 0);
+}
+
+// Number of primes in [lo, hi).
+inline std::uint64_t prime_count(std::uint64_t lo, std::uint64_t hi)
+{
+	combinable<std::uint64_t> count;
+	detail::sieve_segments(lo, hi, [&](std::uint64_t base, std::uint64_t first,
+		std::uint64_t last, const std::uint8_t* composite) {
+		std::uint64_t c = 0;
+		for (std::uint64_t n = first | 1; n < last; n += 2)
+			c += !composite[(n - base) / 2];
+		count.local() += c;
+	});
+	return count.combine(std::plus<std::uint64_t>()) + (lo <= 2 && 2 < hi ? 1 : 0);
+}
+
+// table[n - lo] is 1 iff n is prime, for n in [lo, hi).
+inline std::vector<std::uint8_t> is_prime_table(std::uint64_t lo, std::uint64_t hi)
+{
+	std::vector<std::uint8_t> table(hi > lo ? std::size_t(hi - lo) : 0, 0);
+	detail::sieve_segments(lo, hi, [&](std::uint64_t base, std::uint64_t first,
+		std::uint64_t last, const std::uint8_t* composite) {
+		for (std::uint64_t n = first | 1; n < last; n += 2)
+			table[std::size_t(n - lo)] = !composite[(n - base) / 2];
+	});
+	if (lo <= 2 && 2 < hi)
+		table[std::size_t(2 - lo)] = 1;
+	return table;
+}
+
+} // namespace dx
@@ -0,0 +1,389 @@
+// simd_reduce.h
+// Vectorized sum/min/max/count over contiguous int32, int64, float and
+// double arrays.
+//
+// Each kernel exists as a scalar loop, an AVX2 and an AVX-512 version;
+// the widest one cpu_simd_level() allows is picked on first use. Sums
+// widen as they go: 32-bit integers add up in 64-bit lanes and floats in
+// double lanes, so summing a large int array does not overflow. Several
+// independent accumulators keep the loop limited by memory bandwidth
+// rather than by add latency. parallel_reduce calls simd_sum underneath
+// for contiguous ranges of these types reduced with std::plus.
+//
+// min/max of an empty range is numeric_limits<T>::max()/lowest(); NaNs
+// give an unspecified result.
+#pragma once
+#include "cpu_features.h"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace dx {
+
+namespace detail {
+
+// Kernel element type that T is stored as, or void if there is none.
+template <class T, class = void>
+struct simd_element
+{
+	typedef void type;
+};
+
+template <class T>
+struct simd_element<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type>
+{
+	typedef typename std::conditional<sizeof(T) == 4, std::int32_t,
+		typename std::conditional<sizeof(T) == 8, std::int64_t, void>::type>::type type;
+};
+
+template <>
+struct simd_element<float>
+{
+	typedef float type;
+};
+
+template <>
+struct simd_element<double>
+{
+	typedef double type;
+};
+
+template <class E>
+using simd_sum_t = typename std::conditional<std::is_integral<E>::value, std::int64_t, double>::type;
+
+namespace scalar_kernels {
+
+template <class E>
+simd_sum_t<E> sum(const E* p, std::size_t n)
+{
+	simd_sum_t<E> s = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		s += p[i];
+	return s;
+}
+
+template <class E, bool Max>
+E extreme(const E* p, std::size_t n)
+{
+	E r = Max ? std::numeric_limits<E>::lowest() : (std::numeric_limits<E>::max)();
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		if (Max ? r < p[i] : p[i] < r)
+			r = p[i];
+	}
+	return r;
+}
+
+template <class E>
+std::size_t count(const E* p, std::size_t n, E value)
+{
+	std::size_t c = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		c += p[i] == value;
+	return c;
+}
+
+} // namespace scalar_kernels
+
+#ifdef DX_X86_SIMD
+
+// Each ops<E> describes one register of E: load, widening accumulate into
+// two accumulators, horizontal sum, lane-wise min (lower) and max (upper)
+// and the number of lanes equal to another register. The kernel bodies in
+// simd_reduce_kernels.inl are shared by both instruction sets.
+namespace avx2_kernels {
+
+template <class E>
+struct ops;
+
+template <>
+struct ops<std::int32_t>
+{
+	typedef __m256i V;
+	typedef __m256i A;
+	enum { lanes = 8 };
+	DX_TARGET_AVX2 static V load(const std::int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	DX_TARGET_AVX2 static V set1(std::int32_t v) { return _mm256_set1_epi32(v); }
+	DX_TARGET_AVX2 static void store(std::int32_t* p, V v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	DX_TARGET_AVX2 static A zero() { return _mm256_setzero_si256(); }
+	DX_TARGET_AVX2 static void add(A& a0, A& a1, V x)
+	{
+		a0 = _mm256_add_epi64(a0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+		a1 = _mm256_add_epi64(a1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+	}
+	DX_TARGET_AVX2 static std::int64_t hsum(A a)
+	{
+		__m128i h = _mm_add_epi64(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+		return _mm_cvtsi128_si64(h) + _mm_extract_epi64(h, 1);
+	}
+	DX_TARGET_AVX2 static A plus(A a, A b) { return _mm256_add_epi64(a, b); }
+	DX_TARGET_AVX2 static V lower(V a, V b) { return _mm256_min_epi32(a, b); }
+	DX_TARGET_AVX2 static V upper(V a, V b) { return _mm256_max_epi32(a, b); }
+	DX_TARGET_AVX2 static unsigned equal(V a, V b)
+	{
+		return unsigned(_mm_popcnt_u32(unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))))));
+	}
+};
+
+template <>
+struct ops<std::int64_t>
+{
+	typedef __m256i V;
+	typedef __m256i A;
+	enum { lanes = 4 };
+	DX_TARGET_AVX2 static V load(const std::int64_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	DX_TARGET_AVX2 static V set1(std::int64_t v) { return _mm256_set1_epi64x(v); }
+	DX_TARGET_AVX2 static void store(std::int64_t* p, V v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	DX_TARGET_AVX2 static A zero() { return _mm256_setzero_si256(); }
+	DX_TARGET_AVX2 static void add(A& a0, A&, V x) { a0 = _mm256_add_epi64(a0, x); }
+	DX_TARGET_AVX2 static std::int64_t hsum(A a) { return ops<std::int32_t>::hsum(a); }
+	DX_TARGET_AVX2 static A plus(A a, A b) { return _mm256_add_epi64(a, b); }
+	DX_TARGET_AVX2 static V lower(V a, V b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+	DX_TARGET_AVX2 static V upper(V a, V b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a)); }
+	DX_TARGET_AVX2 static unsigned equal(V a, V b)
+	{
+		return unsigned(_mm_popcnt_u32(unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b))))));
+	}
+};
+
+template <>
+struct ops<double>
+{
+	typedef __m256d V;
+	typedef __m256d A;
+	enum { lanes = 4 };
+	DX_TARGET_AVX2 static V load(const double* p) { return _mm256_loadu_pd(p); }
+	DX_TARGET_AVX2 static V set1(double v) { return _mm256_set1_pd(v); }
+	DX_TARGET_AVX2 static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+	DX_TARGET_AVX2 static A zero() { return _mm256_setzero_pd(); }
+	DX_TARGET_AVX2 static void add(A& a0, A&, V x) { a0 = _mm256_add_pd(a0, x); }
+	DX_TARGET_AVX2 static double hsum(A a)
+	{
+		__m128d h = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+	}
+	DX_TARGET_AVX2 static A plus(A a, A b) { return _mm256_add_pd(a, b); }
+	DX_TARGET_AVX2 static V lower(V a, V b) { return _mm256_min_pd(a, b); }
+	DX_TARGET_AVX2 static V upper(V a, V b) { return _mm256_max_pd(a, b); }
+	DX_TARGET_AVX2 static unsigned equal(V a, V b)
+	{
+		return unsigned(_mm_popcnt_u32(unsigned(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)))));
+	}
+};
+
+template <>
+struct ops<float>
+{
+	typedef __m256 V;
+	typedef __m256d A;
+	enum { lanes = 8 };
+	DX_TARGET_AVX2 static V load(const float* p) { return _mm256_loadu_ps(p); }
+	DX_TARGET_AVX2 static V set1(float v) { return _mm256_set1_ps(v); }
+	DX_TARGET_AVX2 static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+	DX_TARGET_AVX2 static A zero() { return _mm256_setzero_pd(); }
+	DX_TARGET_AVX2 static void add(A& a0, A& a1, V x)
+	{
+		a0 = _mm256_add_pd(a0, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+		a1 = _mm256_add_pd(a1, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+	}
+	DX_TARGET_AVX2 static double hsum(A a) { return ops<double>::hsum(a); }
+	DX_TARGET_AVX2 static A plus(A a, A b) { return _mm256_add_pd(a, b); }
+	DX_TARGET_AVX2 static V lower(V a, V b) { return _mm256_min_ps(a, b); }
+	DX_TARGET_AVX2 static V upper(V a, V b) { return _mm256_max_ps(a, b); }
+	DX_TARGET_AVX2 static unsigned equal(V a, V b)
+	{
+		return unsigned(_mm_popcnt_u32(unsigned(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)))));
+	}
+};
+
+#define DX_SIMD_TARGET DX_TARGET_AVX2
+#include "simd_reduce_kernels.inl"
+#undef DX_SIMD_TARGET
+
+} // namespace avx2_kernels
+
+// GCC 12 reports the undefined pass-through operand of the unmasked
+// AVX-512 intrinsics as maybe-uninitialized.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace avx512_kernels {
+
+template <class E>
+struct ops;
+
+template <>
+struct ops<std::int32_t>
+{
+	typedef __m512i V;
+	typedef __m512i A;
+	enum { lanes = 16 };
+	DX_TARGET_AVX512 static V load(const std::int32_t* p) { return _mm512_loadu_si512(p); }
+	DX_TARGET_AVX512 static V set1(std::int32_t v) { return _mm512_set1_epi32(v); }
+	DX_TARGET_AVX512 static void store(std::int32_t* p, V v) { _mm512_storeu_si512(p, v); }
+	DX_TARGET_AVX512 static A zero() { return _mm512_setzero_si512(); }
+	DX_TARGET_AVX512 static void add(A& a0, A& a1, V x)
+	{
+		a0 = _mm512_add_epi64(a0, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(x)));
+		a1 = _mm512_add_epi64(a1, _mm512_cvtepi32_epi64(_mm512_maskz_extracti64x4_epi64(0xf, x, 1)));
+	}
+	DX_TARGET_AVX512 static std::int64_t hsum(A a)
+	{
+		alignas(64) std::int64_t l[8];
+		_mm512_store_si512(l, a);
+		return ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+	}
+	DX_TARGET_AVX512 static A plus(A a, A b) { return _mm512_add_epi64(a, b); }
+	DX_TARGET_AVX512 static V lower(V a, V b) { return _mm512_min_epi32(a, b); }
+	DX_TARGET_AVX512 static V upper(V a, V b) { return _mm512_max_epi32(a, b); }
+	DX_TARGET_AVX512 static unsigned equal(V a, V b) { return unsigned(_mm_popcnt_u32(_mm512_cmpeq_epi32_mask(a, b))); }
+};
+
+template <>
+struct ops<std::int64_t>
+{
+	typedef __m512i V;
+	typedef __m512i A;
+	enum { lanes = 8 };
+	DX_TARGET_AVX512 static V load(const std::int64_t* p) { return _mm512_loadu_si512(p); }
+	DX_TARGET_AVX512 static V set1(std::int64_t v) { return _mm512_set1_epi64(v); }
+	DX_TARGET_AVX512 static void store(std::int64_t* p, V v) { _mm512_storeu_si512(p, v); }
+	DX_TARGET_AVX512 static A zero() { return _mm512_setzero_si512(); }
+	DX_TARGET_AVX512 static void add(A& a0, A&, V x) { a0 = _mm512_add_epi64(a0, x); }
+	DX_TARGET_AVX512 static std::int64_t hsum(A a) { return ops<std::int32_t>::hsum(a); }
+	DX_TARGET_AVX512 static A plus(A a, A b) { return _mm512_add_epi64(a, b); }
+	DX_TARGET_AVX512 static V lower(V a, V b) { return _mm512_min_epi64(a, b); }
+	DX_TARGET_AVX512 static V upper(V a, V b) { return _mm512_max_epi64(a, b); }
+	DX_TARGET_AVX512 static unsigned equal(V a, V b) { return unsigned(_mm_popcnt_u32(_mm512_cmpeq_epi64_mask(a, b))); }
+};
+
+template <>
+struct ops<double>
+{
+	typedef __m512d V;
+	typedef __m512d A;
+	enum { lanes = 8 };
+	DX_TARGET_AVX512 static V load(const double* p) { return _mm512_loadu_pd(p); }
+	DX_TARGET_AVX512 static V set1(double v) { return _mm512_set1_pd(v); }
+	DX_TARGET_AVX512 static void store(double* p, V v) { _mm512_storeu_pd(p, v); }
+	DX_TARGET_AVX512 static A zero() { return _mm512_setzero_pd(); }
+	DX_TARGET_AVX512 static void add(A& a0, A&, V x) { a0 = _mm512_add_pd(a0, x); }
+	DX_TARGET_AVX512 static double hsum(A a)
+	{
+		alignas(64) double l[8];
+		_mm512_store_pd(l, a);
+		return ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+	}
+	DX_TARGET_AVX512 static A plus(A a, A b) { return _mm512_add_pd(a, b); }
+	DX_TARGET_AVX512 static V lower(V a, V b) { return _mm512_min_pd(a, b); }
+	DX_TARGET_AVX512 static V upper(V a, V b) { return _mm512_max_pd(a, b); }
+	DX_TARGET_AVX512 static unsigned equal(V a, V b) { return unsigned(_mm_popcnt_u32(_mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ))); }
+};
+
+template <>
+struct ops<float>
+{
+	typedef __m512 V;
+	typedef __m512d A;
+	enum { lanes = 16 };
+	DX_TARGET_AVX512 static V load(const float* p) { return _mm512_loadu_ps(p); }
+	DX_TARGET_AVX512 static V set1(float v) { return _mm512_set1_ps(v); }
+	DX_TARGET_AVX512 static void store(float* p, V v) { _mm512_storeu_ps(p, v); }
+	DX_TARGET_AVX512 static A zero() { return _mm512_setzero_pd(); }
+	DX_TARGET_AVX512 static void add(A& a0, A& a1, V x)
+	{
+		a0 = _mm512_add_pd(a0, _mm512_cvtps_pd(_mm512_castps512_ps256(x)));
+		a1 = _mm512_add_pd(a1, _mm512_cvtps_pd(_mm512_maskz_extractf32x8_ps(0xff, x, 1)));
+	}
+	DX_TARGET_AVX512 static double hsum(A a) { return ops<double>::hsum(a); }
+	DX_TARGET_AVX512 static A plus(A a, A b) { return _mm512_add_pd(a, b); }
+	DX_TARGET_AVX512 static V lower(V a, V b) { return _mm512_min_ps(a, b); }
+	DX_TARGET_AVX512 static V upper(V a, V b) { return _mm512_max_ps(a, b); }
+	DX_TARGET_AVX512 static unsigned equal(V a, V b) { return unsigned(_mm_popcnt_u32(_mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ))); }
+};
+
+#define DX_SIMD_TARGET DX_TARGET_AVX512
+#include "simd_reduce_kernels.inl"
+#undef DX_SIMD_TARGET
+
+} // namespace avx512_kernels
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // DX_X86_SIMD
+
+template <class E>
+struct reduce_kernels
+{
+	simd_sum_t<E> (*sum)(const E*, std::size_t);
+	E (*min)(const E*, std::size_t);
+	E (*max)(const E*, std::size_t);
+	std::size_t (*count)(const E*, std::size_t, E);
+};
+
+template <class E>
+const reduce_kernels<E>& select_reduce_kernels()
+{
+	static const reduce_kernels<E> k = [] {
+#ifdef DX_X86_SIMD
+		switch (cpu_simd_level())
+		{
+		case simd_level::avx512:
+			return reduce_kernels<E>{ &avx512_kernels::sum<E>, &avx512_kernels::extreme<E, false>,
+				&avx512_kernels::extreme<E, true>, &avx512_kernels::count<E> };
+		case simd_level::avx2:
+			return reduce_kernels<E>{ &avx2_kernels::sum<E>, &avx2_kernels::extreme<E, false>,
+				&avx2_kernels::extreme<E, true>, &avx2_kernels::count<E> };
+		default:
+			break;
+		}
+#endif
+		return reduce_kernels<E>{ &scalar_kernels::sum<E>, &scalar_kernels::extreme<E, false>,
+			&scalar_kernels::extreme<E, true>, &scalar_kernels::count<E> };
+	}();
+	return k;
+}
+
+template <class T>
+using simd_kernel_element = typename std::enable_if<
+	!std::is_void<typename simd_element<T>::type>::value, typename simd_element<T>::type>::type;
+
+} // namespace detail
+
+// Sum of p[0..n) accumulated in int64_t for integers and double for
+// floating point.
+template <class T>
+detail::simd_sum_t<detail::simd_kernel_element<T>> simd_sum(const T* p, std::size_t n)
+{
+	typedef detail::simd_kernel_element<T> E;
+	return detail::select_reduce_kernels<E>().sum(reinterpret_cast<const E*>(p), n);
+}
+
+template <class T>
+T simd_min(const T* p, std::size_t n)
+{
+	typedef detail::simd_kernel_element<T> E;
+	return T(detail::select_reduce_kernels<E>().min(reinterpret_cast<const E*>(p), n));
+}
+
+template <class T>
+T simd_max(const T* p, std::size_t n)
+{
+	typedef detail::simd_kernel_element<T> E;
+	return T(detail::select_reduce_kernels<E>().max(reinterpret_cast<const E*>(p), n));
+}
+
+// Number of elements equal to value.
+template <class T>
+std::size_t simd_count(const T* p, std::size_t n, T value)
+{
+	typedef detail::simd_kernel_element<T> E;
+	return detail::select_reduce_kernels<E>().count(reinterpret_cast<const E*>(p), n, E(value));
+}
+
+} // namespace dx
@@ -0,0 +1,63 @@
+// simd_reduce_kernels.inl
+// Kernel bodies of simd_reduce.h, written once against ops<E> and included
+// into each instruction set's namespace with DX_SIMD_TARGET set to its
+// target attribute.
+
+template <class E>
+DX_SIMD_TARGET simd_sum_t<E> sum(const E* p, std::size_t n)
+{
+	typedef ops<E> O;
+	typename O::A a0 = O::zero(), a1 = a0, a2 = a0, a3 = a0;
+	std::size_t i = 0;
+	for (; i + 2 * O::lanes <= n; i += 2 * O::lanes)
+	{
+		O::add(a0, a1, O::load(p + i));
+		O::add(a2, a3, O::load(p + i + O::lanes));
+	}
+	for (; i + O::lanes <= n; i += O::lanes)
+		O::add(a0, a1, O::load(p + i));
+	return O::hsum(O::plus(O::plus(a0, a1), O::plus(a2, a3))) + scalar_kernels::sum(p + i, n - i);
+}
+
+template <class E, bool Max>
+DX_SIMD_TARGET E extreme(const E* p, std::size_t n)
+{
+	typedef ops<E> O;
+	const E init = Max ? std::numeric_limits<E>::lowest() : (std::numeric_limits<E>::max)();
+	typename O::V a0 = O::set1(init), a1 = a0;
+	std::size_t i = 0;
+	for (; i + 2 * O::lanes <= n; i += 2 * O::lanes)
+	{
+		a0 = Max ? O::upper(a0, O::load(p + i)) : O::lower(a0, O::load(p + i));
+		a1 = Max ? O::upper(a1, O::load(p + i + O::lanes)) : O::lower(a1, O::load(p + i + O::lanes));
+	}
+	for (; i + O::lanes <= n; i += O::lanes)
+		a0 = Max ? O::upper(a0, O::load(p + i)) : O::lower(a0, O::load(p + i));
+
+	E lanes[2 * O::lanes];
+	O::store(lanes, a0);
+	O::store(lanes + O::lanes, a1);
+	E r = scalar_kernels::extreme<E, Max>(p + i, n - i);
+	for (E v : lanes)
+	{
+		if (Max ? r < v : v < r)
+			r = v;
+	}
+	return r;
+}
+
+template <class E>
+DX_SIMD_TARGET std::size_t count(const E* p, std::size_t n, E value)
+{
+	typedef ops<E> O;
+	const typename O::V v = O::set1(value);
+	std::size_t c0 = 0, c1 = 0, i = 0;
+	for (; i + 2 * O::lanes <= n; i += 2 * O::lanes)
+	{
+		c0 += O::equal(O::load(p + i), v);
+		c1 += O::equal(O::load(p + i + O::lanes), v);
+	}
+	for (; i + O::lanes <= n; i += O::lanes)
+		c0 += O::equal(O::load(p + i), v);
+	return c0 + c1 + scalar_kernels::count(p + i, n - i, value);
+}
@@ -0,0 +1,381 @@
+// sort_network.h
+// In-register bitonic sorting networks for blocks of 8, 16 or 32 elements.
+//
+// A block is loaded into AVX2 registers and run through the bitonic
+// network with vector min/max: compare distances of a register or more
+// pair up whole registers, shorter ones pair lanes of one register through
+// a permute and keep the min or the max per lane with a blend. No branches
+// depend on the data. Covers int32, uint32, float and int64 (and types of
+// the same representation) keys, alone or with a payload array of the same
+// width whose registers follow the key compares; the caller falls back to
+// its scalar code when a function returns false (other types or sizes, or
+// no AVX2 on the CPU).
+#pragma once
+#include "cpu_features.h"
+#include <cstdint>
+#include <type_traits>
+
+namespace dx {
+
+namespace detail {
+
+// Element type a network handles T as, or void.
+template <class T, class = void>
+struct network_element
+{
+	typedef void type;
+};
+
+template <class T>
+struct network_element<T, typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 4>::type>
+{
+	typedef typename std::conditional<std::is_signed<T>::value, std::int32_t, std::uint32_t>::type type;
+};
+
+template <class T>
+struct network_element<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value && sizeof(T) == 8>::type>
+{
+	typedef std::int64_t type;
+};
+
+template <>
+struct network_element<float>
+{
+	typedef float type;
+};
+
+#ifdef DX_X86_SIMD
+
+namespace avx2_network {
+
+// load/store, lane-wise lower/upper, the greater mask that moves payloads
+// along, and the lane width for building permute indexes and blend masks
+// in 32-bit units.
+template <class E>
+struct ops;
+
+template <>
+struct ops<std::int32_t>
+{
+	enum { lanes = 8, width = 1 };
+	DX_TARGET_AVX2 static __m256i load(const std::int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	DX_TARGET_AVX2 static void store(std::int32_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	DX_TARGET_AVX2 static __m256i lower(__m256i a, __m256i b) { return _mm256_min_epi32(a, b); }
+	DX_TARGET_AVX2 static __m256i upper(__m256i a, __m256i b) { return _mm256_max_epi32(a, b); }
+	DX_TARGET_AVX2 static __m256i greater(__m256i a, __m256i b) { return _mm256_cmpgt_epi32(a, b); }
+};
+
+template <>
+struct ops<std::uint32_t>
+{
+	enum { lanes = 8, width = 1 };
+	DX_TARGET_AVX2 static __m256i load(const std::uint32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	DX_TARGET_AVX2 static void store(std::uint32_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	DX_TARGET_AVX2 static __m256i lower(__m256i a, __m256i b) { return _mm256_min_epu32(a, b); }
+	DX_TARGET_AVX2 static __m256i upper(__m256i a, __m256i b) { return _mm256_max_epu32(a, b); }
+	DX_TARGET_AVX2 static __m256i greater(__m256i a, __m256i b)
+	{
+		const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+		return _mm256_cmpgt_epi32(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+	}
+};
+
+template <>
+struct ops<float>
+{
+	enum { lanes = 8, width = 1 };
+	DX_TARGET_AVX2 static __m256i load(const float* p) { return _mm256_castps_si256(_mm256_loadu_ps(p)); }
+	DX_TARGET_AVX2 static void store(float* p, __m256i v) { _mm256_storeu_ps(p, _mm256_castsi256_ps(v)); }
+	DX_TARGET_AVX2 static __m256i lower(__m256i a, __m256i b)
+	{
+		return _mm256_castps_si256(_mm256_min_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b)));
+	}
+	DX_TARGET_AVX2 static __m256i upper(__m256i a, __m256i b)
+	{
+		return _mm256_castps_si256(_mm256_max_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b)));
+	}
+	DX_TARGET_AVX2 static __m256i greater(__m256i a, __m256i b)
+	{
+		return _mm256_castps_si256(_mm256_cmp_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _CMP_GT_OQ));
+	}
+};
+
+template <>
+struct ops<std::int64_t>
+{
+	enum { lanes = 4, width = 2 };
+	DX_TARGET_AVX2 static __m256i load(const std::int64_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	DX_TARGET_AVX2 static void store(std::int64_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	DX_TARGET_AVX2 static __m256i lower(__m256i a, __m256i b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+	DX_TARGET_AVX2 static __m256i upper(__m256i a, __m256i b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)); }
+	DX_TARGET_AVX2 static __m256i greater(__m256i a, __m256i b) { return _mm256_cmpgt_epi64(a, b); }
+};
+
+// Lane l of a register after exchanging element i with i ^ J in the
+// column of block size K: whether it keeps the upper of the pair.
+constexpr bool takes_upper(int i, int l, int J, int K, bool ascending)
+{
+	return ((l & J) != 0) == (((i & K) == 0) == ascending);
+}
+
+// Lane of 32-bit word w in a register of W lanes.
+constexpr int lane_of(int w, int W)
+{
+	return w / (8 / W);
+}
+
+// One column of the network over R registers of keys r and, with
+// Values, of payloads v: compare-exchange every element i with i ^ J,
+// ascending where ((i & K) == 0) == Ascending. Keys alone take min/max;
+// payloads follow their keys through a greater mask, and equal keys stay
+// in place with their payloads.
+template <class E, int R, int J, int K, bool Ascending, bool Values>
+DX_TARGET_AVX2 inline void step(__m256i* r, __m256i* v)
+{
+	typedef ops<E> O;
+	constexpr int W = O::lanes;
+	if constexpr (J >= W)
+	{
+		constexpr int JR = J / W;
+		for (int a = 0; a < R; ++a)
+		{
+			if (a & JR)
+				continue;
+			const int b = a + JR;
+			const bool up = (((a * W) & K) == 0) == Ascending;
+			if constexpr (Values)
+			{
+				const __m256i swap = up ? O::greater(r[a], r[b]) : O::greater(r[b], r[a]);
+				const __m256i ka = r[a], va = v[a];
+				r[a] = _mm256_blendv_epi8(ka, r[b], swap);
+				r[b] = _mm256_blendv_epi8(r[b], ka, swap);
+				v[a] = _mm256_blendv_epi8(va, v[b], swap);
+				v[b] = _mm256_blendv_epi8(v[b], va, swap);
+			}
+			else
+			{
+				const __m256i lo = O::lower(r[a], r[b]), hi = O::upper(r[a], r[b]);
+				r[a] = up ? lo : hi;
+				r[b] = up ? hi : lo;
+			}
+		}
+	}
+	else
+	{
+#define DX_NETWORK_INDEX(w) ((lane_of(w, W) ^ J) * O::width + (w) % O::width)
+		const __m256i perm = _mm256_setr_epi32(DX_NETWORK_INDEX(0), DX_NETWORK_INDEX(1),
+			DX_NETWORK_INDEX(2), DX_NETWORK_INDEX(3), DX_NETWORK_INDEX(4), DX_NETWORK_INDEX(5),
+			DX_NETWORK_INDEX(6), DX_NETWORK_INDEX(7));
+#undef DX_NETWORK_INDEX
+		for (int a = 0; a < R; ++a)
+		{
+#define DX_NETWORK_MASK(w) (takes_upper(a * W + lane_of(w, W), lane_of(w, W), J, K, Ascending) ? -1 : 0)
+			const __m256i mask = _mm256_setr_epi32(DX_NETWORK_MASK(0), DX_NETWORK_MASK(1),
+				DX_NETWORK_MASK(2), DX_NETWORK_MASK(3), DX_NETWORK_MASK(4), DX_NETWORK_MASK(5),
+				DX_NETWORK_MASK(6), DX_NETWORK_MASK(7));
+#undef DX_NETWORK_MASK
+			const __m256i p = _mm256_permutevar8x32_epi32(r[a], perm);
+			if constexpr (Values)
+			{
+				// Lanes keeping the upper take the partner if it is greater,
+				// the others if it is smaller.
+				const __m256i take = _mm256_blendv_epi8(O::greater(r[a], p), O::greater(p, r[a]), mask);
+				r[a] = _mm256_blendv_epi8(r[a], p, take);
+				v[a] = _mm256_blendv_epi8(v[a], _mm256_permutevar8x32_epi32(v[a], perm), take);
+			}
+			else
+			{
+				r[a] = _mm256_blendv_epi8(O::lower(r[a], p), O::upper(r[a], p), mask);
+			}
+		}
+	}
+}
+
+// Columns J, J / 2, ..., 1 of block size K, then the blocks of size 2K up
+// to N.
+template <class E, int R, int J, int K, bool Ascending, bool Values>
+DX_TARGET_AVX2 inline void columns(__m256i* r, __m256i* v)
+{
+	constexpr int N = R * ops<E>::lanes;
+	step<E, R, J, K, Ascending, Values>(r, v);
+	if constexpr (J > 1)
+		columns<E, R, J / 2, K, Ascending, Values>(r, v);
+	else if constexpr (K < N)
+		columns<E, R, K, 2 * K, Ascending, Values>(r, v);
+}
+
+// Sorts the N = R * lanes keys at p, and with Values the payloads of the
+// same width at values; MergeOnly runs the last block of columns only,
+// which sorts a bitonic sequence.
+template <class E, int R, bool Ascending, bool MergeOnly, bool Values>
+DX_TARGET_AVX2 void run(E* p, void* values)
+{
+	typedef ops<E> O;
+	constexpr int N = R * O::lanes;
+	__m256i r[R], v[Values ? R : 1];
+	__m256i* pv = reinterpret_cast<__m256i*>(values);
+	for (int a = 0; a < R; ++a)
+	{
+		r[a] = O::load(p + a * O::lanes);
+		if constexpr (Values)
+			v[a] = _mm256_loadu_si256(pv + a);
+	}
+	if constexpr (MergeOnly)
+		columns<E, R, N / 2, N, Ascending, Values>(r, v);
+	else
+		columns<E, R, 1, 2, Ascending, Values>(r, v);
+	for (int a = 0; a < R; ++a)
+	{
+		O::store(p + a * O::lanes, r[a]);
+		if constexpr (Values)
+			_mm256_storeu_si256(pv + a, v[a]);
+	}
+}
+
+template <class E, int N, bool Values>
+void run(E* p, void* values, bool ascending, bool merge_only)
+{
+	constexpr int R = N / ops<E>::lanes;
+	if (merge_only)
+		ascending ? run<E, R, true, true, Values>(p, values) : run<E, R, false, true, Values>(p, values);
+	else
+		ascending ? run<E, R, true, false, Values>(p, values) : run<E, R, false, false, Values>(p, values);
+}
+
+template <class E, bool Values>
+bool dispatch(E* p, void* values, int n, bool ascending, bool merge_only)
+{
+	if (cpu_simd_level() < simd_level::avx2)
+		return false;
+	switch (n)
+	{
+	case 8:
+		run<E, 8, Values>(p, values, ascending, merge_only);
+		return true;
+	case 16:
+		run<E, 16, Values>(p, values, ascending, merge_only);
+		return true;
+	case 32:
+		run<E, 32, Values>(p, values, ascending, merge_only);
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Compare-exchanges lo[i] with hi[i] for i < n, the smaller of each pair
+// to lo when ascending.
+template <class E>
+DX_TARGET_AVX2 void exchange(E* lo, E* hi, int n, bool ascending)
+{
+	typedef ops<E> O;
+	int i = 0;
+	for (; i + O::lanes <= n; i += O::lanes)
+	{
+		const __m256i a = O::load(lo + i), b = O::load(hi + i);
+		O::store(lo + i, ascending ? O::lower(a, b) : O::upper(a, b));
+		O::store(hi + i, ascending ? O::upper(a, b) : O::lower(a, b));
+	}
+	for (; i < n; ++i)
+	{
+		if (ascending == (hi[i] < lo[i]))
+		{
+			const E t = lo[i];
+			lo[i] = hi[i];
+			hi[i] = t;
+		}
+	}
+}
+
+} // namespace avx2_network
+
+#endif // DX_X86_SIMD
+
+// Payloads ride in the key's lanes, so they must have the key's width and
+// be copyable as bytes.
+template <class T, class U>
+struct network_payload
+	: std::integral_constant<bool, sizeof(U) == sizeof(T) && std::is_trivially_copyable<U>::value>
+{
+};
+
+template <class T, class U>
+bool network(T* p, U* values, int n, bool ascending, bool merge_only)
+{
+	typedef typename network_element<T>::type E;
+	constexpr bool with_values = !std::is_void<U>::value;
+#ifdef DX_X86_SIMD
+	if constexpr (!std::is_void<E>::value)
+	{
+		if constexpr (!with_values)
+			return avx2_network::dispatch<E, false>(reinterpret_cast<E*>(p), nullptr, n, ascending, merge_only);
+		else if constexpr (network_payload<T, U>::value)
+			return avx2_network::dispatch<E, true>(reinterpret_cast<E*>(p), values, n, ascending, merge_only);
+	}
+#endif
+	(void)p;
+	(void)values;
+	(void)n;
+	(void)ascending;
+	(void)merge_only;
+	(void)with_values;
+	return false;
+}
+
+} // namespace detail
+
+// Sorts p[0, n) for n = 8, 16 or 32. Returns false, leaving p untouched,
+// when there is no network for T and n on this CPU.
+template <class T>
+bool network_sort(T* p, int n, bool ascending = true)
+{
+	return detail::network(p, static_cast<void*>(nullptr), n, ascending, false);
+}
+
+// Sorts the bitonic sequence p[0, n) for n = 8, 16 or 32, i.e. the last
+// column block of the network only. Returns false like network_sort.
+template <class T>
+bool network_merge(T* p, int n, bool ascending = true)
+{
+	return detail::network(p, static_cast<void*>(nullptr), n, ascending, true);
+}
+
+// One column of a network across two runs: compare-exchanges lo[i] with
+// hi[i] for i < n, the smaller of each pair to lo when ascending, for any
+// n. Returns false, leaving the runs untouched, when there is no vector
+// code for T on this CPU.
+template <class T>
+bool network_exchange(T* lo, T* hi, int n, bool ascending = true)
+{
+	typedef typename detail::network_element<T>::type E;
+#ifdef DX_X86_SIMD
+	if constexpr (!std::is_void<E>::value)
+	{
+		if (cpu_simd_level() < simd_level::avx2)
+			return false;
+		detail::avx2_network::exchange(reinterpret_cast<E*>(lo), reinterpret_cast<E*>(hi), n, ascending);
+		return true;
+	}
+#endif
+	(void)lo;
+	(void)hi;
+	(void)n;
+	(void)ascending;
+	return false;
+}
+
+// Key/value forms: values[i] moves with keys[i]. U must be as wide as T
+// and trivially copyable, or they return false.
+template <class T, class U>
+bool network_sort(T* keys, U* values, int n, bool ascending = true)
+{
+	return detail::network(keys, values, n, ascending, false);
+}
+
+template <class T, class U>
+bool network_merge(T* keys, U* values, int n, bool ascending = true)
+{
+	return detail::network(keys, values, n, ascending, true);
+}
+
+} // namespace dx
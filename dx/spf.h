@@ -0,0 +1,178 @@
+// spf.h
+// Smallest-prime-factor table and Carmichael tests built on the sieve.
+//
+// spf_table holds the smallest prime factor of every odd n below a limit
+// of at most 2^32. A composite n < 2^32 has a factor below 2^16, so every
+// entry is a uint16_t, 0 marking a prime, and even numbers are not stored:
+// one byte per number in all. It is sieved segment by segment in parallel,
+// each segment writing only its own entries with the odd base primes in
+// ascending order, so the first prime to reach an entry is its smallest
+// factor. Once built the table is only read, and any number of workers
+// may share it; factoring n takes one lookup per prime factor.
+//
+// is_carmichael() applies Korselt's criterion to that factorization: n is
+// a Carmichael number iff it is composite, squarefree, and p - 1 divides
+// n - 1 for every prime p | n.
+//
+// carmichael_numbers(lo, hi) needs no table over the range. It sieves
+// [lo, hi) in segments like sieve_segments, dividing each number by the
+// base primes that hit it and checking Korselt's condition as it goes; what
+// is left of a number at the end is 1 or its one prime factor above
+// sqrt(hi). Memory is one segment per worker, so it covers all of
+// [0, 2^32) where a table would not fit.
+#pragma once
+#include "ppl.h"
+#include "sieve.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dx {
+
+class spf_table
+{
+public:
+	// Smallest prime factors of the numbers below limit (at most 2^32).
+	explicit spf_table(std::uint64_t limit)
+		: _limit(limit), _spf(std::size_t((limit + 1) / 2), 0)
+	{
+		if (limit < 9)
+			return;
+		const std::vector<std::uint32_t> primes = small_primes(detail::isqrt(limit - 1));
+		const std::uint64_t span = detail::sieve_segment_span;
+		const std::uint64_t segments = (limit + span - 1) / span;
+		parallel_for(std::uint64_t(0), segments, [&](std::uint64_t s) {
+			const std::uint64_t base = s * span, end = (std::min)(base + span, limit);
+			for (std::size_t k = 1; k < primes.size(); ++k)
+			{
+				const std::uint64_t p = primes[k];
+				if (p * p >= end)
+					break;
+				std::uint64_t m = (std::max)(p * p, (base + p - 1) / p * p);
+				if ((m & 1) == 0)
+					m += p;
+				for (; m < end; m += 2 * p)
+				{
+					std::uint16_t& e = _spf[std::size_t(m / 2)];
+					if (e == 0)
+						e = std::uint16_t(p);
+				}
+			}
+		});
+	}
+
+	std::uint64_t limit() const { return _limit; }
+
+	// Smallest prime factor of 2 <= n < limit().
+	std::uint32_t spf(std::uint32_t n) const
+	{
+		if ((n & 1) == 0)
+			return 2;
+		const std::uint16_t e = _spf[n / 2];
+		return e ? e : n;
+	}
+
+	// Korselt's criterion on the factorization from the table, for
+	// n < limit().
+	bool is_carmichael(std::uint32_t n) const
+	{
+		if (n < 3 || (n & 1) == 0 || _spf[n / 2] == 0)
+			return false;
+		std::uint32_t k = n;
+		while (k > 1)
+		{
+			const std::uint32_t p = spf(k);
+			k /= p;
+			if (k % p == 0 || (n - 1) % (p - 1) != 0)
+				return false;
+		}
+		return true;
+	}
+
+	// Entries in bytes.
+	std::size_t bytes() const { return _spf.size() * sizeof(std::uint16_t); }
+
+private:
+	std::uint64_t _limit;
+	std::vector<std::uint16_t> _spf;
+};
+
+// The Carmichael numbers in [lo, hi), hi <= 2^32, in ascending order.
+inline std::vector<std::uint32_t> carmichael_numbers(std::uint64_t lo, std::uint64_t hi)
+{
+	std::vector<std::uint32_t> result;
+	if (hi <= lo)
+		return result;
+	const std::vector<std::uint32_t> primes = small_primes(detail::isqrt(hi - 1));
+	const std::uint64_t span = detail::sieve_segment_span;
+	const std::uint64_t first_base = lo / span * span;
+	const std::uint64_t segments = (hi - first_base + span - 1) / span;
+
+	// Per odd number of a segment: what is left to factor, and how many
+	// prime factors came off (0xff once it cannot be a Carmichael number).
+	struct buffer
+	{
+		std::vector<std::uint32_t> rest;
+		std::vector<std::uint8_t> factors;
+	};
+	const std::uint8_t rejected = 0xff;
+	combinable<buffer> buffers;
+	std::vector<std::vector<std::uint32_t>> found((std::size_t(segments)));
+	parallel_for(std::uint64_t(0), segments, [&](std::uint64_t s) {
+		buffer& b = buffers.local();
+		const std::uint64_t base = first_base + s * span, end = (std::min)(base + span, hi);
+		b.rest.resize(std::size_t(span / 2));
+		b.factors.assign(std::size_t(span / 2), 0);
+		for (std::size_t i = 0; i < span / 2; ++i)
+			b.rest[i] = std::uint32_t(base + 2 * i + 1);
+
+		for (std::size_t k = 1; k < primes.size(); ++k)
+		{
+			const std::uint64_t p = primes[k];
+			if (p * p >= end)
+				break;
+			std::uint64_t m = (base + p - 1) / p * p;
+			if ((m & 1) == 0)
+				m += p;
+			for (; m < end; m += 2 * p)
+			{
+				const std::size_t i = std::size_t((m - base) / 2);
+				if (b.factors[i] == rejected)
+					continue;
+				const std::uint32_t r = b.rest[i] / std::uint32_t(p);
+				if (r % p == 0 || (m - 1) % (p - 1) != 0)
+				{
+					b.factors[i] = rejected;
+					continue;
+				}
+				b.rest[i] = r;
+				++b.factors[i];
+			}
+		}
+
+		std::vector<std::uint32_t>& out = found[std::size_t(s)];
+		for (std::uint64_t n = (std::max)(base, lo) | 1; n < end; n += 2)
+		{
+			const std::size_t i = std::size_t((n - base) / 2);
+			std::uint32_t f = b.factors[i];
+			if (f == rejected)
+				continue;
+			const std::uint32_t r = b.rest[i];
+			if (r > 1)
+			{
+				if ((n - 1) % (r - 1) != 0)
+					continue;
+				++f;
+			}
+			if (f >= 2)
+				out.push_back(std::uint32_t(n));
+		}
+	});
+
+	for (const std::vector<std::uint32_t>& f : found)
+		result.insert(result.end(), f.begin(), f.end());
+	return result;
+}
+
+} // namespace dx
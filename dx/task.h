@@ -0,0 +1,321 @@
+// task.h
+// Value-returning tasks with continuations, in the shape of <ppltasks.h>:
+// create_task, task<T>::then, task<T>::get/wait and when_all.
+#pragma once
+#include "scheduler.h"
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dx {
+
+template <class T>
+class task;
+
+namespace detail {
+
+// Stand-in for the value of a task<void>.
+struct unit {};
+
+template <class T>
+struct task_value { typedef T type; };
+
+template <>
+struct task_value<void> { typedef unit type; };
+
+// Shared state of a task: the value or exception and the continuations to
+// run once either is set.
+template <class V>
+class task_state
+{
+public:
+	task_state() : _done(false) {}
+
+	bool is_done() const { return _done.load(std::memory_order_acquire); }
+
+	void set_value(V v)
+	{
+		_value.emplace(std::move(v));
+		finish();
+	}
+
+	void set_error(std::exception_ptr e)
+	{
+		_error = e;
+		finish();
+	}
+
+	// Runs f when the state is set; right away if it already is.
+	void on_done(std::function<void()> f)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_done.load(std::memory_order_relaxed))
+			{
+				_continuations.push_back(std::move(f));
+				return;
+			}
+		}
+		f();
+	}
+
+	void wait() const
+	{
+		scheduler::instance().wait_until([this] { return is_done(); });
+	}
+
+	V& get()
+	{
+		wait();
+		if (_error)
+			std::rethrow_exception(_error);
+		return *_value;
+	}
+
+	std::exception_ptr error() const { return _error; }
+
+private:
+	void finish()
+	{
+		std::vector<std::function<void()>> continuations;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_done.store(true, std::memory_order_release);
+			continuations.swap(_continuations);
+		}
+		for (auto& f : continuations)
+			f();
+	}
+
+	std::mutex _mutex;
+	std::atomic<bool> _done;
+	std::optional<V> _value;
+	std::exception_ptr _error;
+	std::vector<std::function<void()>> _continuations;
+};
+
+// Work item that owns its function and frees itself after running it.
+template <class F>
+class detached_item : public work_item
+{
+public:
+	explicit detached_item(F f) : _f(std::move(f)) {}
+
+	void execute() override
+	{
+		_f();
+		delete this;
+	}
+
+private:
+	F _f;
+};
+
+template <class F>
+void spawn_detached(F f)
+{
+	scheduler::instance().spawn(new detached_item<F>(std::move(f)));
+}
+
+// Calls f and stores its result (or exception) in st.
+template <class V, class F>
+void run_into(task_state<V>& st, F& f)
+{
+	try
+	{
+		if constexpr (std::is_void<decltype(f())>::value)
+		{
+			f();
+			st.set_value(unit());
+		}
+		else
+		{
+			st.set_value(f());
+		}
+	}
+	catch (...)
+	{
+		st.set_error(std::current_exception());
+	}
+}
+
+// Result of a continuation: task-based ones take the antecedent task,
+// value-based ones take its value.
+template <class F, class T, bool TaskBased = std::is_invocable<F&, task<T>>::value>
+struct continuation_result
+{
+	typedef std::invoke_result_t<F&, task<T>> type;
+};
+
+template <class F, class T>
+struct continuation_result<F, T, false>
+{
+	typedef std::invoke_result_t<F&, T> type;
+};
+
+template <class F>
+struct continuation_result<F, void, false>
+{
+	typedef std::invoke_result_t<F&> type;
+};
+
+} // namespace detail
+
+template <class T>
+class task
+{
+	typedef typename detail::task_value<T>::type value_type;
+	typedef detail::task_state<value_type> state_type;
+
+public:
+	typedef T result_type;
+
+	task() {}
+	explicit task(std::shared_ptr<state_type> state) : _state(std::move(state)) {}
+
+	// Waits for the task and returns its value; rethrows its exception.
+	T get() const
+	{
+		if constexpr (std::is_void<T>::value)
+			_state->get();
+		else
+			return _state->get();
+	}
+
+	void wait() const { _state->wait(); }
+
+	bool is_done() const { return _state->is_done(); }
+
+	// Schedules f to run after this task. A value-based continuation
+	// receives get(), a task-based one receives the task itself.
+	template <class F>
+	auto then(F f) const
+	{
+		typedef typename detail::continuation_result<F, T>::type R;
+		typedef detail::task_state<typename detail::task_value<R>::type> next_state;
+
+		auto next = std::make_shared<next_state>();
+		task<T> self = *this;
+		_state->on_done([self, next, f]() {
+			detail::spawn_detached([self, next, f]() mutable {
+				if constexpr (std::is_invocable<F&, task<T>>::value)
+				{
+					auto call = [&] { return f(self); };
+					detail::run_into(*next, call);
+				}
+				else if (self._state->error())
+				{
+					next->set_error(self._state->error());
+				}
+				else if constexpr (std::is_void<T>::value)
+				{
+					detail::run_into(*next, f);
+				}
+				else
+				{
+					auto call_value = [&] { return f(self._state->get()); };
+					detail::run_into(*next, call_value);
+				}
+			});
+		});
+		return task<R>(next);
+	}
+
+private:
+	template <class>
+	friend class task;
+	template <class It>
+	friend auto when_all(It first, It last);
+
+	std::shared_ptr<state_type> _state;
+};
+
+// Runs f on the scheduler and returns a task for its result.
+template <class F>
+auto create_task(F f)
+{
+	typedef std::invoke_result_t<F&> R;
+	auto state = std::make_shared<detail::task_state<typename detail::task_value<R>::type>>();
+	detail::spawn_detached([state, f]() mutable { detail::run_into(*state, f); });
+	return task<R>(state);
+}
+
+// Task that completes when every task in [first, last) has. Yields the
+// values in input order (nothing for tasks of void).
+template <class It>
+auto when_all(It first, It last)
+{
+	typedef typename std::iterator_traits<It>::value_type::result_type T;
+	typedef typename std::conditional<std::is_void<T>::value, void, std::vector<T>>::type R;
+	typedef detail::task_state<typename detail::task_value<R>::type> state_type;
+
+	struct join
+	{
+		std::vector<std::optional<typename detail::task_value<T>::type>> values;
+		std::atomic<std::size_t> remaining;
+		std::atomic<bool> failed;
+		std::exception_ptr error;
+		std::shared_ptr<state_type> state;
+	};
+
+	auto j = std::make_shared<join>();
+	std::size_t n = std::size_t(std::distance(first, last));
+	j->values.resize(n);
+	j->remaining.store(n);
+	j->failed.store(false);
+	j->state = std::make_shared<state_type>();
+	task<R> result(j->state);
+
+	auto complete = [](join& j) {
+		if (j.failed.load())
+		{
+			j.state->set_error(j.error);
+		}
+		else if constexpr (std::is_void<T>::value)
+		{
+			j.state->set_value(detail::unit());
+		}
+		else
+		{
+			std::vector<T> out;
+			out.reserve(j.values.size());
+			for (auto& v : j.values)
+				out.push_back(std::move(*v));
+			j.state->set_value(std::move(out));
+		}
+	};
+
+	if (n == 0)
+	{
+		complete(*j);
+		return result;
+	}
+	std::size_t i = 0;
+	for (; first != last; ++first, ++i)
+	{
+		auto antecedent = first->_state;
+		antecedent->on_done([j, antecedent, i, complete] {
+			if (std::exception_ptr e = antecedent->error())
+			{
+				bool expected = false;
+				if (j->failed.compare_exchange_strong(expected, true))
+					j->error = e;
+			}
+			else
+			{
+				j->values[i].emplace(antecedent->get());
+			}
+			if (j->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				complete(*j);
+		});
+	}
+	return result;
+}
+
+} // namespace dx
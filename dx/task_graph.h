@@ -0,0 +1,473 @@
+// task_graph.h
+// Reusable graph of value-returning tasks: create_task, then, when_all and
+// when_any with the semantics of task.h, but built once and run many times.
+//
+// Nodes, their results and the edges between them live in the graph's
+// arena and are spawned directly as work items, so running a graph does no
+// heap allocation. Input nodes hold values that are set before each run:
+//
+//     task_graph g;
+//     auto x = g.input<int>();
+//     auto a = g.create_task([] { return 88; });
+//     auto b = x.then([](int v) { return v * 2; });
+//     auto sum = g.when_all({ a, b }).then([](const graph_results<int>& r) {
+//         return accumulate(begin(r), end(r), 0);
+//     });
+//     for (int v : inputs) { x.set(v); g.run(); use(sum.get()); }
+#pragma once
+#include "arena.h"
+#include "scheduler.h"
+#include "task.h"
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <initializer_list>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace dx {
+
+class task_graph;
+
+namespace detail {
+
+class graph_node_base;
+
+struct graph_edge
+{
+	graph_node_base* to;
+	graph_edge* next;
+};
+
+class graph_node_base : public work_item
+{
+public:
+	explicit graph_node_base(task_graph* g)
+		: graph(g), predecessors(0), successors(nullptr), next_in_graph(nullptr),
+		pending(0), poisoned(false)
+	{
+	}
+
+	void execute() override;
+
+	// Clears the result of the previous run.
+	virtual void reset()
+	{
+		pending.store(initial_pending(), std::memory_order_relaxed);
+		poisoned.store(false, std::memory_order_relaxed);
+	}
+
+	// Called when predecessor p has finished; true when this node is ready.
+	virtual bool predecessor_done(graph_node_base* p)
+	{
+		if (p->poisoned.load(std::memory_order_relaxed))
+			poisoned.store(true, std::memory_order_relaxed);
+		return pending.fetch_sub(1, std::memory_order_acq_rel) == 1;
+	}
+
+	virtual int initial_pending() const { return predecessors; }
+
+	task_graph* graph;
+	int predecessors;
+	graph_edge* successors;
+	graph_node_base* next_in_graph;
+	std::atomic<int> pending;
+	std::atomic<bool> poisoned;
+
+protected:
+	virtual void run() = 0;
+};
+
+template <class V>
+class graph_value_node : public graph_node_base
+{
+public:
+	using graph_node_base::graph_node_base;
+
+	void reset() override
+	{
+		graph_node_base::reset();
+		value.reset();
+	}
+
+	std::optional<V> value;
+};
+
+} // namespace detail
+
+template <class T>
+class graph_node;
+
+// Values of the inputs of a when_all node, in input order.
+template <class T>
+class graph_results
+{
+	typedef detail::graph_value_node<T> node_type;
+
+public:
+	class const_iterator
+	{
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const T* pointer;
+		typedef const T& reference;
+
+		explicit const_iterator(node_type* const* p = nullptr) : _p(p) {}
+		reference operator*() const { return *(*_p)->value; }
+		pointer operator->() const { return &*(*_p)->value; }
+		const_iterator& operator++() { ++_p; return *this; }
+		const_iterator operator++(int) { const_iterator t = *this; ++_p; return t; }
+		const_iterator& operator--() { --_p; return *this; }
+		const_iterator& operator+=(difference_type k) { _p += k; return *this; }
+		const_iterator operator+(difference_type k) const { return const_iterator(_p + k); }
+		difference_type operator-(const const_iterator& o) const { return _p - o._p; }
+		reference operator[](difference_type k) const { return *_p[k]->value; }
+		bool operator==(const const_iterator& o) const { return _p == o._p; }
+		bool operator!=(const const_iterator& o) const { return _p != o._p; }
+		bool operator<(const const_iterator& o) const { return _p < o._p; }
+
+	private:
+		node_type* const* _p;
+	};
+
+	graph_results(node_type* const* inputs, std::size_t n) : _inputs(inputs), _n(n) {}
+
+	std::size_t size() const { return _n; }
+	const T& operator[](std::size_t i) const { return *_inputs[i]->value; }
+	const_iterator begin() const { return const_iterator(_inputs); }
+	const_iterator end() const { return const_iterator(_inputs + _n); }
+
+private:
+	node_type* const* _inputs;
+	std::size_t _n;
+};
+
+class task_graph
+{
+public:
+	explicit task_graph(std::size_t arena_block = 16 * 1024)
+		: _arena(arena_block), _nodes(nullptr), _node_count(0), _remaining(0), _failed(false)
+	{
+	}
+
+	task_graph(const task_graph&) = delete;
+	task_graph& operator=(const task_graph&) = delete;
+
+	// Node whose value is set by the caller before each run.
+	template <class T>
+	graph_node<T> input();
+
+	// Source node computing f().
+	template <class F>
+	auto create_task(F f);
+
+	// Node whose value lists the values of the inputs, in order.
+	template <class T>
+	graph_node<graph_results<T>> when_all(std::initializer_list<graph_node<T>> inputs);
+
+	// Node that takes the value and index of whichever input finishes first.
+	template <class T>
+	graph_node<std::pair<T, std::size_t>> when_any(std::initializer_list<graph_node<T>> inputs);
+
+	// Runs every node once and waits for all of them. Rethrows the first
+	// exception a node threw; nodes downstream of it are skipped.
+	void run()
+	{
+		_failed.store(false, std::memory_order_relaxed);
+		_error = nullptr;
+		for (detail::graph_node_base* n = _nodes; n; n = n->next_in_graph)
+			n->reset();
+		_remaining.store(_node_count, std::memory_order_relaxed);
+		scheduler& s = scheduler::instance();
+		for (detail::graph_node_base* n = _nodes; n; n = n->next_in_graph)
+		{
+			if (n->predecessors == 0)
+				s.spawn(n);
+		}
+		s.wait_until([this] { return _remaining.load(std::memory_order_acquire) == 0; });
+		if (_failed.load(std::memory_order_acquire))
+			std::rethrow_exception(_error);
+	}
+
+	std::size_t size() const { return _node_count; }
+
+	// Bytes reserved by the arena.
+	std::size_t arena_capacity() const { return _arena.capacity(); }
+
+private:
+	template <class>
+	friend class graph_node;
+	friend class detail::graph_node_base;
+
+	template <class Node, class... Args>
+	Node* add(Args&&... args)
+	{
+		Node* n = _arena.create<Node>(this, std::forward<Args>(args)...);
+		n->next_in_graph = _nodes;
+		_nodes = n;
+		++_node_count;
+		return n;
+	}
+
+	void connect(detail::graph_node_base* from, detail::graph_node_base* to)
+	{
+		detail::graph_edge* e = _arena.create<detail::graph_edge>();
+		e->to = to;
+		e->next = from->successors;
+		from->successors = e;
+		++to->predecessors;
+	}
+
+	void fail(std::exception_ptr e)
+	{
+		bool expected = false;
+		if (_failed.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+			_error = e;
+	}
+
+	void finished(detail::graph_node_base* n)
+	{
+		scheduler& s = scheduler::instance();
+		for (detail::graph_edge* e = n->successors; e; e = e->next)
+		{
+			if (e->to->predecessor_done(n))
+				s.spawn(e->to);
+		}
+		_remaining.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	arena _arena;
+	detail::graph_node_base* _nodes;
+	std::size_t _node_count;
+	std::atomic<std::size_t> _remaining;
+	std::atomic<bool> _failed;
+	std::exception_ptr _error;
+};
+
+namespace detail {
+
+inline void graph_node_base::execute()
+{
+	if (!poisoned.load(std::memory_order_relaxed))
+	{
+		try
+		{
+			run();
+		}
+		catch (...)
+		{
+			poisoned.store(true, std::memory_order_relaxed);
+			graph->fail(std::current_exception());
+		}
+	}
+	graph->finished(this);
+}
+
+template <class V>
+class graph_input_node : public graph_value_node<V>
+{
+public:
+	using graph_value_node<V>::graph_value_node;
+
+	// The input keeps its value across runs.
+	void reset() override { graph_node_base::reset(); }
+
+protected:
+	void run() override {}
+};
+
+// Node computing f(input values...).
+template <class V, class F, class... In>
+class graph_fn_node : public graph_value_node<V>
+{
+public:
+	graph_fn_node(task_graph* g, F f, graph_value_node<In>*... inputs)
+		: graph_value_node<V>(g), _f(std::move(f)), _inputs(inputs...)
+	{
+	}
+
+protected:
+	void run() override
+	{
+		std::apply([this](graph_value_node<In>*... in) {
+			if constexpr (std::is_void<decltype(_f(*in->value...))>::value)
+			{
+				_f(*in->value...);
+				this->value.emplace();
+			}
+			else
+			{
+				this->value.emplace(_f(*in->value...));
+			}
+		}, _inputs);
+	}
+
+private:
+	F _f;
+	std::tuple<graph_value_node<In>*...> _inputs;
+};
+
+template <class T>
+class graph_all_node : public graph_value_node<graph_results<T>>
+{
+public:
+	graph_all_node(task_graph* g, graph_value_node<T>** inputs, std::size_t n)
+		: graph_value_node<graph_results<T>>(g), _inputs(inputs), _n(n)
+	{
+	}
+
+protected:
+	void run() override { this->value.emplace(_inputs, _n); }
+
+private:
+	graph_value_node<T>** _inputs;
+	std::size_t _n;
+};
+
+template <class T>
+class graph_any_node : public graph_value_node<std::pair<T, std::size_t>>
+{
+public:
+	graph_any_node(task_graph* g, graph_value_node<T>** inputs, std::size_t n)
+		: graph_value_node<std::pair<T, std::size_t>>(g), _inputs(inputs), _n(n), _first(nullptr)
+	{
+	}
+
+	int initial_pending() const override { return 1; }
+
+	void reset() override
+	{
+		graph_value_node<std::pair<T, std::size_t>>::reset();
+		_first.store(nullptr, std::memory_order_relaxed);
+	}
+
+	bool predecessor_done(graph_node_base* p) override
+	{
+		graph_node_base* expected = nullptr;
+		if (!_first.compare_exchange_strong(expected, p, std::memory_order_acq_rel))
+			return false;
+		if (p->poisoned.load(std::memory_order_relaxed))
+			this->poisoned.store(true, std::memory_order_relaxed);
+		return true;
+	}
+
+protected:
+	void run() override
+	{
+		graph_node_base* p = _first.load(std::memory_order_acquire);
+		for (std::size_t i = 0; i < _n; ++i)
+		{
+			if (_inputs[i] == p)
+				this->value.emplace(*_inputs[i]->value, i);
+		}
+	}
+
+private:
+	graph_value_node<T>** _inputs;
+	std::size_t _n;
+	std::atomic<graph_node_base*> _first;
+};
+
+} // namespace detail
+
+// Handle to a node of a task_graph.
+template <class T>
+class graph_node
+{
+	typedef typename detail::task_value<T>::type value_type;
+	typedef detail::graph_value_node<value_type> node_type;
+
+public:
+	graph_node() : _node(nullptr) {}
+	explicit graph_node(node_type* n) : _node(n) {}
+
+	// Node computing f(value of this node); f() for nodes of void.
+	template <class F>
+	auto then(F f) const
+	{
+		task_graph* g = _node->graph;
+		if constexpr (std::is_void<T>::value)
+		{
+			typedef std::invoke_result_t<F&> R;
+			typedef detail::graph_fn_node<typename detail::task_value<R>::type,
+				decltype(drop_unit(f)), value_type> node;
+			node* n = g->add<node>(drop_unit(f), _node);
+			g->connect(_node, n);
+			return graph_node<R>(n);
+		}
+		else
+		{
+			typedef std::invoke_result_t<F&, const T&> R;
+			typedef detail::graph_fn_node<typename detail::task_value<R>::type, F, value_type> node;
+			node* n = g->add<node>(std::move(f), _node);
+			g->connect(_node, n);
+			return graph_node<R>(n);
+		}
+	}
+
+	// Value of the last run.
+	const value_type& get() const { return *_node->value; }
+
+	// Sets the value of an input node for the next run.
+	template <class U>
+	void set(U&& v) const { _node->value.emplace(std::forward<U>(v)); }
+
+private:
+	friend class task_graph;
+
+	template <class F>
+	static auto drop_unit(F f)
+	{
+		return [f](const detail::unit&) mutable { return f(); };
+	}
+
+	node_type* _node;
+};
+
+template <class T>
+graph_node<T> task_graph::input()
+{
+	return graph_node<T>(add<detail::graph_input_node<T>>());
+}
+
+template <class F>
+auto task_graph::create_task(F f)
+{
+	typedef std::invoke_result_t<F&> R;
+	typedef detail::graph_fn_node<typename detail::task_value<R>::type, F> node;
+	return graph_node<R>(add<node>(std::move(f)));
+}
+
+template <class T>
+graph_node<graph_results<T>> task_graph::when_all(std::initializer_list<graph_node<T>> inputs)
+{
+	typedef detail::graph_value_node<T> input_type;
+	input_type** in = _arena.allocate_array<input_type*>(inputs.size());
+	std::size_t i = 0;
+	for (auto& x : inputs)
+		in[i++] = x._node;
+	auto* n = add<detail::graph_all_node<T>>(in, inputs.size());
+	for (auto& x : inputs)
+		connect(x._node, n);
+	return graph_node<graph_results<T>>(n);
+}
+
+template <class T>
+graph_node<std::pair<T, std::size_t>> task_graph::when_any(std::initializer_list<graph_node<T>> inputs)
+{
+	typedef detail::graph_value_node<T> input_type;
+	input_type** in = _arena.allocate_array<input_type*>(inputs.size());
+	std::size_t i = 0;
+	for (auto& x : inputs)
+		in[i++] = x._node;
+	auto* n = add<detail::graph_any_node<T>>(in, inputs.size());
+	for (auto& x : inputs)
+		connect(x._node, n);
+	return graph_node<std::pair<T, std::size_t>>(n);
+}
+
+} // namespace dx
@@ -0,0 +1,209 @@
+// top_k.h
+// concurrent_top_k: the k lowest-cost values offered by any number of
+// threads, without locks.
+//
+// The k kept values are k slots, each one atomic word that packs a 32-bit
+// cost with the 32-bit index of its value in a concurrent_vector, so a
+// slot is replaced by one compare-exchange and a value never moves. An
+// insert takes an index from a lock-free free list (or appends one), puts
+// its value there, scans the slots for the worst one and swaps itself in if
+// it is still the worst and still worse than the new cost; on a lost race
+// it scans again. The index of the value it evicts, or its own if it is not
+// kept, goes back on the free list; values are only read by sorted(), never
+// during inserts, so the evicting thread owns it. Storage is therefore k
+// values plus one per insert in flight, however many values are offered.
+//
+// bound() is the k-th best cost so far (until k values are in, the bound
+// given to the constructor), or briefly above it while inserts race. It is
+// published in one atomic word and only ever goes down. A value whose cost
+// is at or above it is rejected by that one relaxed load, without writing
+// shared memory, and a search can prune any branch that cannot get below
+// it. Slot costs only go down too, so the worst cost an insert reads is
+// never below the true one, and lowering the bound to it with an atomic
+// min keeps it safe: no value that belongs in the top k is ever rejected.
+//
+// Costs are below 2^32 - 1, and k plus the number of concurrent inserts
+// below 2^32 - 1. Of equal costs the first kept stays.
+#pragma once
+#include "concurrent_vector.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace dx {
+
+template <class T>
+class concurrent_top_k
+{
+	static const std::uint32_t no_cost = 0xffffffffu;
+	static const std::uint32_t no_index = 0xffffffffu;
+	static const std::uint64_t empty_slot = ~std::uint64_t(0);
+
+	// A value and the next index of the free list while it is on it.
+	struct entry
+	{
+		explicit entry(T&& v) : value(std::move(v)), next(no_index) {}
+		entry(entry&& o) : value(std::move(o.value)), next(o.next.load(std::memory_order_relaxed)) {}
+
+		T value;
+		std::atomic<std::uint32_t> next;
+	};
+
+public:
+	// Keeps the k lowest costs below bound.
+	explicit concurrent_top_k(std::size_t k, std::uint32_t bound = no_cost)
+		: _k(k), _slots(new std::atomic<std::uint64_t>[k]), _initial_bound(bound)
+	{
+		clear();
+	}
+
+	concurrent_top_k(const concurrent_top_k&) = delete;
+	concurrent_top_k& operator=(const concurrent_top_k&) = delete;
+
+	std::size_t capacity() const { return _k; }
+
+	// Costs at or above this are rejected.
+	std::uint32_t bound() const { return _bound.load(std::memory_order_relaxed); }
+
+	// Offers value at cost; true if it was kept.
+	bool insert(std::uint32_t cost, const T& value)
+	{
+		if (cost >= bound())
+			return false;
+		return insert_new(cost, value);
+	}
+
+	bool insert(std::uint32_t cost, T&& value)
+	{
+		if (cost >= bound())
+			return false;
+		return insert_new(cost, std::move(value));
+	}
+
+	// The kept costs and values, lowest cost first. Not safe to call
+	// concurrently with insert().
+	std::vector<std::pair<std::uint32_t, T>> sorted() const
+	{
+		std::vector<std::pair<std::uint32_t, T>> out;
+		for (std::size_t j = 0; j < _k; ++j)
+		{
+			const std::uint64_t w = _slots[j].load(std::memory_order_acquire);
+			if (w != empty_slot)
+				out.emplace_back(cost_of(w), _values[index_of(w)].value);
+		}
+		std::stable_sort(out.begin(), out.end(),
+			[](const std::pair<std::uint32_t, T>& a, const std::pair<std::uint32_t, T>& b) { return a.first < b.first; });
+		return out;
+	}
+
+	// Empties the collector and restores the constructor's bound. Not safe
+	// to call concurrently with anything else.
+	void clear()
+	{
+		for (std::size_t j = 0; j < _k; ++j)
+			_slots[j].store(empty_slot, std::memory_order_relaxed);
+		_values.clear();
+		_free.store(no_index, std::memory_order_relaxed);
+		_bound.store(_k ? _initial_bound : 0, std::memory_order_relaxed);
+	}
+
+private:
+	static std::uint32_t cost_of(std::uint64_t w) { return std::uint32_t(w >> 32); }
+	static std::uint32_t index_of(std::uint64_t w) { return std::uint32_t(w); }
+
+	// An index that holds value and that no slot or other insert uses.
+	template <class U>
+	std::uint32_t acquire(U&& value)
+	{
+		// The head word is a tag above the index, so a head that was popped
+		// and pushed again in between fails the compare-exchange.
+		std::uint64_t head = _free.load(std::memory_order_acquire);
+		while (index_of(head) != no_index)
+		{
+			const std::uint32_t i = index_of(head);
+			const std::uint64_t next = ((head >> 32) + 1) << 32 | _values[i].next.load(std::memory_order_relaxed);
+			if (_free.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				_values[i].value = std::forward<U>(value);
+				return i;
+			}
+		}
+		return std::uint32_t(_values.push_back(entry(T(std::forward<U>(value)))) - _values.begin());
+	}
+
+	// Puts index i, which the caller owns, back on the free list.
+	void release(std::uint32_t i)
+	{
+		std::uint64_t head = _free.load(std::memory_order_relaxed);
+		do
+		{
+			_values[i].next.store(index_of(head), std::memory_order_relaxed);
+		} while (!_free.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | i, std::memory_order_release,
+			std::memory_order_relaxed));
+	}
+
+	template <class U>
+	bool insert_new(std::uint32_t cost, U&& value)
+	{
+		const std::uint32_t index = acquire(std::forward<U>(value));
+		const std::uint64_t word = std::uint64_t(cost) << 32 | index;
+		for (;;)
+		{
+			std::size_t worst = 0;
+			std::uint64_t w = _slots[0].load(std::memory_order_acquire);
+			for (std::size_t j = 1; j < _k && w != empty_slot; ++j)
+			{
+				const std::uint64_t x = _slots[j].load(std::memory_order_acquire);
+				if (x == empty_slot || cost_of(x) > cost_of(w))
+				{
+					worst = j;
+					w = x;
+				}
+			}
+			if (w != empty_slot && cost >= cost_of(w))
+			{
+				release(index);
+				return false;
+			}
+			if (_slots[worst].compare_exchange_strong(w, word, std::memory_order_acq_rel))
+			{
+				if (w != empty_slot)
+					release(index_of(w));
+				break;
+			}
+		}
+		publish_bound();
+		return true;
+	}
+
+	// Lowers the bound to the worst kept cost once all slots are full.
+	void publish_bound()
+	{
+		std::uint32_t worst = 0;
+		for (std::size_t j = 0; j < _k; ++j)
+		{
+			const std::uint64_t w = _slots[j].load(std::memory_order_relaxed);
+			if (w == empty_slot)
+				return;
+			worst = (std::max)(worst, cost_of(w));
+		}
+		std::uint32_t cur = _bound.load(std::memory_order_relaxed);
+		while (worst < cur && !_bound.compare_exchange_weak(cur, worst, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	std::size_t _k;
+	std::unique_ptr<std::atomic<std::uint64_t>[]> _slots;
+	concurrent_vector<entry> _values;
+	// Tag << 32 | index of the first free entry.
+	std::atomic<std::uint64_t> _free;
+	std::uint32_t _initial_bound;
+	std::atomic<std::uint32_t> _bound;
+};
+
+} // namespace dx
@@ -0,0 +1,146 @@
+// ws_deque.h
+// Chase-Lev work-stealing deque.
+//
+// The owner thread pushes and pops at the bottom (LIFO), any other thread
+// steals from the top (FIFO). The memory orderings follow
+// "Correct and Efficient Work-Stealing for Weak Memory Models"
+// (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace dx {
+namespace detail {
+
+template <class T>
+class ws_deque
+{
+	// Circular buffer of a power-of-two capacity.
+	struct ring
+	{
+		explicit ring(std::int64_t capacity)
+			: mask(capacity - 1), items(new std::atomic<T*>[capacity])
+		{
+		}
+		~ring() { delete[] items; }
+
+		std::int64_t capacity() const { return mask + 1; }
+		T* get(std::int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+		void put(std::int64_t i, T* x) { items[i & mask].store(x, std::memory_order_relaxed); }
+
+		ring* grow(std::int64_t b, std::int64_t t) const
+		{
+			ring* r = new ring(capacity() * 2);
+			for (std::int64_t i = t; i < b; ++i)
+				r->put(i, get(i));
+			return r;
+		}
+
+		std::int64_t mask;
+		std::atomic<T*>* items;
+	};
+
+public:
+	explicit ws_deque(std::int64_t capacity = 256)
+		: _top(0), _bottom(0), _ring(new ring(capacity))
+	{
+	}
+
+	~ws_deque()
+	{
+		delete _ring.load(std::memory_order_relaxed);
+		for (ring* r : _retired)
+			delete r;
+	}
+
+	ws_deque(const ws_deque&) = delete;
+	ws_deque& operator=(const ws_deque&) = delete;
+
+	// Owner only.
+	void push(T* x)
+	{
+		std::int64_t b = _bottom.load(std::memory_order_relaxed);
+		std::int64_t t = _top.load(std::memory_order_acquire);
+		ring* r = _ring.load(std::memory_order_relaxed);
+		if (b - t > r->capacity() - 1)
+		{
+			// Thieves may still read the old ring, so it is only freed
+			// together with the deque.
+			_retired.push_back(r);
+			r = r->grow(b, t);
+			_ring.store(r, std::memory_order_release);
+		}
+		r->put(b, x);
+		std::atomic_thread_fence(std::memory_order_release);
+		_bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	// Owner only. Returns nullptr when the deque is empty.
+	T* pop()
+	{
+		std::int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+		ring* r = _ring.load(std::memory_order_relaxed);
+		_bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t t = _top.load(std::memory_order_relaxed);
+
+		T* x = nullptr;
+		if (t <= b)
+		{
+			x = r->get(b);
+			if (t == b)
+			{
+				// Last item: race against thieves for it.
+				if (!_top.compare_exchange_strong(t, t + 1,
+					std::memory_order_seq_cst, std::memory_order_relaxed))
+				{
+					x = nullptr;
+				}
+				_bottom.store(b + 1, std::memory_order_relaxed);
+			}
+		}
+		else
+		{
+			_bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return x;
+	}
+
+	// Any thread. Returns nullptr when the deque is empty or the steal lost a race.
+	T* steal()
+	{
+		std::int64_t t = _top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::int64_t b = _bottom.load(std::memory_order_acquire);
+		if (t < b)
+		{
+			ring* r = _ring.load(std::memory_order_acquire);
+			T* x = r->get(t);
+			if (!_top.compare_exchange_strong(t, t + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				return nullptr;
+			}
+			return x;
+		}
+		return nullptr;
+	}
+
+	// Approximate; used by idle workers to decide whether to sleep.
+	bool empty() const
+	{
+		std::int64_t b = _bottom.load(std::memory_order_relaxed);
+		std::int64_t t = _top.load(std::memory_order_relaxed);
+		return b <= t;
+	}
+
+private:
+	alignas(64) std::atomic<std::int64_t> _top;
+	alignas(64) std::atomic<std::int64_t> _bottom;
+	std::atomic<ring*> _ring;
+	std::vector<ring*> _retired;
+};
+
+} // namespace detail
+} // namespace dx
@@ -11,12 +11,14 @@
 // File: BitonicSort.cpp
 // 
 // Implements Bitonic sort in C++ AMP
-// Supports only int, unsigned, long and unsigned long
+// Sorts int, unsigned, long and unsigned long, keys of those types with a
+// payload array, or records by a key projection
 //----------------------------------------------------------------------------
 
 #include <assert.h>
 #include <amp.h>
 #include <iostream>
+#include "../dx/bench.h"
 
 #pragma warning ( disable : 4267)
 using namespace concurrency;
@@ -30,16 +32,6 @@ using namespace concurrency;
 // else parallel_for_each will crash
 #define TRANSPOSE_BLOCK_SIZE        16
 
-// Calls the provided work function and returns the number of milliseconds  
-// that it takes to call that function. 
-template <class Function>
-__int64 time_call(Function&& f)
-{
-	__int64 begin = GetTickCount();
-	f();
-	return GetTickCount() - begin;
-}
-
 void ComputeMatrixMult(const array<float, 2> &mA, const array<float, 2> &mB,
 	array<float, 2> &mC)
  {
@@ -93,6 +85,144 @@ void bitonic_sort_kernel(array<_type, 1>& data, unsigned ulevel, unsigned ulevel
     data[global_idx] = sh_data[local_idx];
 }
 
+//----------------------------------------------------------------------------
+// Kernels for any number of elements n. The network is the one for the
+// next power of two with the missing elements at the end acting as values
+// larger than any other. Every compare-exchange puts the smaller value at
+// the lower index (the first step of each level compares mirrored pairs
+// instead of flipping directions), so those virtual elements never move
+// and are never stored: threads and tile slots past n skip them.
+//----------------------------------------------------------------------------
+
+// One step across tiles: element i against i ^ mask.
+template <typename _type>
+void bitonic_step_kernel(array<_type, 1>& data, unsigned n, unsigned mask, index<1> idx) restrict (amp)
+{
+    unsigned i = idx[0];
+    unsigned partner = i ^ mask;
+    if (partner > i && partner < n)
+    {
+        _type a = data[i];
+        _type b = data[partner];
+        if (b < a)
+        {
+            data[i] = b;
+            data[partner] = a;
+        }
+    }
+}
+
+// Steps step, step / 2, ..., 1 of level ulevel within a tile; with flip the
+// first one compares mirrored pairs, local_idx ^ (ulevel - 1).
+template <typename _type>
+void bitonic_tile_kernel(array<_type, 1>& data, unsigned n, unsigned ulevel, unsigned step, bool flip, tiled_index<BITONIC_BLOCK_SIZE> tidx) restrict (amp)
+{
+    tile_static _type sh_data[BITONIC_BLOCK_SIZE];
+
+    unsigned local_idx = tidx.local[0];
+    unsigned global_idx = tidx.global[0];
+    unsigned tile_start = global_idx - local_idx;
+    bool valid = global_idx < n;
+
+    if (valid)
+        sh_data[local_idx] = data[global_idx];
+    tidx.barrier.wait();
+
+    unsigned mask = flip ? ulevel - 1 : step;
+    for (unsigned j = step; j > 0; j >>= 1, mask = j)
+    {
+        unsigned partner = local_idx ^ mask;
+        _type result = valid ? sh_data[local_idx] : _type();
+        if (valid && tile_start + partner < n)
+        {
+            _type other = sh_data[partner];
+            if ((local_idx < partner) ? (other < result) : (result < other))
+                result = other;
+        }
+        tidx.barrier.wait();
+        if (valid)
+            sh_data[local_idx] = result;
+        tidx.barrier.wait();
+    }
+
+    if (valid)
+        data[global_idx] = sh_data[local_idx];
+}
+
+// Key/value forms of the two kernels above: a payload moves only when its
+// key does.
+template <typename _key, typename _value>
+void bitonic_step_kernel(array<_key, 1>& keys, array<_value, 1>& values, unsigned n, unsigned mask, index<1> idx) restrict (amp)
+{
+    unsigned i = idx[0];
+    unsigned partner = i ^ mask;
+    if (partner > i && partner < n)
+    {
+        _key a = keys[i];
+        _key b = keys[partner];
+        if (b < a)
+        {
+            keys[i] = b;
+            keys[partner] = a;
+            _value v = values[i];
+            values[i] = values[partner];
+            values[partner] = v;
+        }
+    }
+}
+
+template <typename _key, typename _value>
+void bitonic_tile_kernel(array<_key, 1>& keys, array<_value, 1>& values, unsigned n, unsigned ulevel, unsigned step, bool flip, tiled_index<BITONIC_BLOCK_SIZE> tidx) restrict (amp)
+{
+    tile_static _key sh_keys[BITONIC_BLOCK_SIZE];
+    tile_static _value sh_values[BITONIC_BLOCK_SIZE];
+
+    unsigned local_idx = tidx.local[0];
+    unsigned global_idx = tidx.global[0];
+    unsigned tile_start = global_idx - local_idx;
+    bool valid = global_idx < n;
+
+    if (valid)
+    {
+        sh_keys[local_idx] = keys[global_idx];
+        sh_values[local_idx] = values[global_idx];
+    }
+    tidx.barrier.wait();
+
+    unsigned mask = flip ? ulevel - 1 : step;
+    for (unsigned j = step; j > 0; j >>= 1, mask = j)
+    {
+        unsigned partner = local_idx ^ mask;
+        bool take = false;
+        if (valid && tile_start + partner < n)
+        {
+            _key mine = sh_keys[local_idx];
+            _key other = sh_keys[partner];
+            take = (local_idx < partner) ? (other < mine) : (mine < other);
+        }
+        _key key;
+        _value value;
+        if (take)
+        {
+            key = sh_keys[partner];
+            value = sh_values[partner];
+        }
+        tidx.barrier.wait();
+        if (take)
+        {
+            sh_keys[local_idx] = key;
+            sh_values[local_idx] = value;
+        }
+        tidx.barrier.wait();
+    }
+
+    if (valid)
+    {
+        keys[global_idx] = sh_keys[local_idx];
+        values[global_idx] = sh_values[local_idx];
+    }
+}
+
 //----------------------------------------------------------------------------
 // Kernel implements 2D matrix transpose
 //----------------------------------------------------------------------------
@@ -124,9 +254,155 @@ void filldata(std::vector<_type>& data)
 //----------------------------------------------------------------------------
 // CPU helper driving accelerator sorting
 //----------------------------------------------------------------------------
+// Runs the levels of the network for any number of elements n: the steps
+// of a level longer than a tile as step_pass(mask) over the whole array,
+// the rest as one tile_pass(level, step, flip).
+template <typename _step_pass, typename _tile_pass>
+void bitonic_levels(unsigned n, const _step_pass& step_pass, const _tile_pass& tile_pass)
+{
+    unsigned levels = 1;
+    while (levels < n)
+        levels <<= 1;
+
+    for (unsigned level = 2; level <= levels; level = level * 2)
+    {
+        unsigned step = level / 2;
+        bool flip = true;
+        for (; step >= BITONIC_BLOCK_SIZE; step /= 2)
+        {
+            step_pass(flip ? level - 1 : step);
+            flip = false;
+        }
+        tile_pass(level, step, flip);
+    }
+}
+
+// Sorts any number of elements; the device array holds exactly n of them.
+template <typename _type>
+void bitonic_sort_amp_any(std::vector<_type>& data_in, std::vector<_type>& data_out)
+{
+    assert(data_out.size() == data_in.size());
+    unsigned n = data_in.size();
+    if (n < 2)
+    {
+        std::copy(data_in.begin(), data_in.end(), data_out.begin());
+        return;
+    }
+
+    array<_type, 1> data(n, data_in.begin());
+    extent<1> cdomain_num_elements(n);
+    extent<1> cdomain_tiles((n + BITONIC_BLOCK_SIZE - 1) / BITONIC_BLOCK_SIZE * BITONIC_BLOCK_SIZE);
+    bitonic_levels(n,
+        [&] (unsigned mask)
+        {
+            parallel_for_each(cdomain_num_elements, [=, &data] (index<1> idx) restrict(amp)
+            {
+                bitonic_step_kernel<_type>(data, n, mask, idx);
+            });
+        },
+        [&] (unsigned level, unsigned step, bool flip)
+        {
+            parallel_for_each(cdomain_tiles.tile<BITONIC_BLOCK_SIZE>(),
+                [=, &data] (tiled_index<BITONIC_BLOCK_SIZE> tidx) restrict(amp)
+            {
+                bitonic_tile_kernel<_type>(data, n, level, step, flip, tidx);
+            });
+        });
+
+    copy(data, data_out.begin());
+}
+
+// Sorts the keys on the accelerator, in place, and the values with them.
+template <typename _key, typename _value>
+void bitonic_sort_amp(array<_key, 1>& keys, array<_value, 1>& values)
+{
+    unsigned n = keys.extent[0];
+    extent<1> cdomain_num_elements(n);
+    extent<1> cdomain_tiles((n + BITONIC_BLOCK_SIZE - 1) / BITONIC_BLOCK_SIZE * BITONIC_BLOCK_SIZE);
+    bitonic_levels(n,
+        [&] (unsigned mask)
+        {
+            parallel_for_each(cdomain_num_elements, [=, &keys, &values] (index<1> idx) restrict(amp)
+            {
+                bitonic_step_kernel<_key, _value>(keys, values, n, mask, idx);
+            });
+        },
+        [&] (unsigned level, unsigned step, bool flip)
+        {
+            parallel_for_each(cdomain_tiles.tile<BITONIC_BLOCK_SIZE>(),
+                [=, &keys, &values] (tiled_index<BITONIC_BLOCK_SIZE> tidx) restrict(amp)
+            {
+                bitonic_tile_kernel<_key, _value>(keys, values, n, level, step, flip, tidx);
+            });
+        });
+}
+
+// Key/value sort: values_out[i] is the value that came with keys_out[i].
+// The keys and the payloads stay separate arrays, so the compares only
+// read keys and a payload is only moved when its key is.
+template <typename _key, typename _value>
+void bitonic_sort_amp(std::vector<_key>& keys_in, std::vector<_value>& values_in,
+    std::vector<_key>& keys_out, std::vector<_value>& values_out)
+{
+    assert(values_in.size() == keys_in.size());
+    assert(keys_out.size() == keys_in.size() && values_out.size() == keys_in.size());
+    if (keys_in.size() < 2)
+    {
+        std::copy(keys_in.begin(), keys_in.end(), keys_out.begin());
+        std::copy(values_in.begin(), values_in.end(), values_out.begin());
+        return;
+    }
+
+    array<_key, 1> keys(keys_in.size(), keys_in.begin());
+    array<_value, 1> values(values_in.size(), values_in.begin());
+    bitonic_sort_amp(keys, values);
+    copy(keys, keys_out.begin());
+    copy(values, values_out.begin());
+}
+
+// Sorts records by proj(record), which must be restrict(amp, cpu). The
+// keys are projected into their own array with the record indexes as
+// payload, sorted, and the records are then gathered once, so wide
+// records are not moved by every compare-exchange.
+template <typename _type, typename _proj>
+void bitonic_sort_amp(std::vector<_type>& data_in, std::vector<_type>& data_out, const _proj& proj)
+{
+    typedef decltype(proj(data_in[0])) _key;
+    assert(data_out.size() == data_in.size());
+    unsigned n = data_in.size();
+    if (n < 2)
+    {
+        std::copy(data_in.begin(), data_in.end(), data_out.begin());
+        return;
+    }
+
+    array<_type, 1> data(n, data_in.begin());
+    array<_type, 1> sorted(n);
+    array<_key, 1> keys(n);
+    array<unsigned, 1> order(n);
+    parallel_for_each(keys.extent, [=, &data, &keys, &order] (index<1> idx) restrict(amp)
+    {
+        keys[idx] = proj(data[idx]);
+        order[idx] = idx[0];
+    });
+    bitonic_sort_amp(keys, order);
+    parallel_for_each(sorted.extent, [=, &data, &sorted, &order] (index<1> idx) restrict(amp)
+    {
+        sorted[idx] = data[order[idx]];
+    });
+    copy(sorted, data_out.begin());
+}
+
 template <typename _type>
 void bitonic_sort_amp(std::vector<_type>& data_in, std::vector<_type>& data_out)
 {
+    // The transposes below need exactly NUM_ELEMENTS, a square of tiles.
+    if (data_in.size() != NUM_ELEMENTS)
+    {
+        bitonic_sort_amp_any(data_in, data_out);
+        return;
+    }
+
 	// Verify assumptions
 	assert(NUM_ELEMENTS/MATRIX_WIDTH == MATRIX_WIDTH);
 	assert(((MATRIX_WIDTH%TRANSPOSE_BLOCK_SIZE) == 0) && ((MATRIX_HEIGHT%TRANSPOSE_BLOCK_SIZE) == 0));
@@ -215,31 +491,73 @@ bool verify(std::vector<_type>& data)
     return true;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	accelerator default_device;
 	std::wcout << L"Using device : " << default_device.get_description() << std::endl;
 	if (default_device == accelerator(accelerator::direct3d_ref))
 		std::cout << "WARNING!! Running on very slow emulator! Only use this accelerator for debugging." << std::endl;
 
-    unsigned length = NUM_ELEMENTS;
 	WarmUp();
     {
-        std::vector<int> datain(length);
-        std::vector<int> dataout(length);
-        printf ("Filling with %d int type ...\n", length);
-        filldata<int>(datain);
+        // NUM_ELEMENTS takes the transpose path, other sizes the general one.
+        const unsigned lengths[] = { NUM_ELEMENTS, 1000000 };
+        std::vector<int> datain[2], dataout[2];
+        dx::bench::suite suite("BitonicSort");
+        for (int s = 0; s < 2; ++s)
+        {
+            unsigned length = lengths[s];
+            datain[s].resize(length);
+            dataout[s].resize(length);
+            printf ("Filling with %d int type ...\n", length);
+            filldata<int>(datain[s]);
+            std::vector<int>& in = datain[s];
+            std::vector<int>& out = dataout[s];
+            suite.add_serial("bitonic_sort_amp " + std::to_string(length), [&in, &out] { bitonic_sort_amp<int>(in, out); });
+        }
+
+        // Record ids by key: a key array with an id payload, and key/id
+        // records through a projection.
+        struct record
+        {
+            int key;
+            int id;
+        };
+        unsigned length = lengths[1];
+        std::vector<int> ids(length), keys_out(length), ids_out(length);
+        std::vector<record> records(length), records_out(length);
+        for (unsigned i = 0; i < length; i++)
+        {
+            ids[i] = i;
+            records[i].key = datain[1][i];
+            records[i].id = i;
+        }
+        auto key = [] (const record& r) restrict(amp, cpu) { return r.key; };
+        suite.add_serial("bitonic_sort_amp keys+ids", [&] { bitonic_sort_amp(datain[1], ids, keys_out, ids_out); });
+        suite.add_serial("bitonic_sort_amp records", [&] { bitonic_sort_amp(records, records_out, key); });
 
         printf ("Offloading sort to accelerator\n");
-		__int64 elapsed = time_call([&] { bitonic_sort_amp<int>(datain, dataout);});
-		std::cout << "cost time: " << elapsed << std::endl;
-
-        printf ("Verify data on CPU : ");
-        if (verify<int>(dataout))
-            printf ("Correct");
-        else
-            printf ("Incorrect");
-        printf ("\n\n");
+		if (int rc = suite.run(argc, argv))
+			return rc;
+
+        for (int s = 0; s < 2; ++s)
+        {
+            printf ("Verify %d elements on CPU : ", lengths[s]);
+            if (verify<int>(dataout[s]))
+                printf ("Correct");
+            else
+                printf ("Incorrect");
+            printf ("\n");
+        }
+        bool ok = verify<int>(keys_out);
+        for (unsigned i = 0; ok && i < length; i++)
+            ok = datain[1][ids_out[i]] == keys_out[i];
+        printf ("Verify keys+ids on CPU : %s\n", ok ? "Correct" : "Incorrect");
+        ok = true;
+        for (unsigned i = 0; ok && i < length; i++)
+            ok = (i == 0 || records_out[i - 1].key <= records_out[i].key) && datain[1][records_out[i].id] == records_out[i].key;
+        printf ("Verify records on CPU : %s\n", ok ? "Correct" : "Incorrect");
+        printf ("\n");
     }
 
     return 0;
@@ -19,19 +19,11 @@
 
 #include <random>
 #include <assert.h>
+#include "../dx/bench.h"
 using namespace concurrency;
 
 #define DATA_TYPE float
 
-// Calls the provided work function and returns the number of milliseconds  
-// that it takes to call that function. 
-template <class Function>
-__int64 time_call(Function&& f)
-{
-	__int64 begin = GetTickCount64();
-	f();
-	return GetTickCount64() - begin;
-}
 //----------------------------------------------------------------------------
 // Generate random data
 //----------------------------------------------------------------------------
@@ -222,7 +214,7 @@ bool verify(std::vector<double>& v_res, std::vector<double>& v_ref, int len)
     return passed;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
     accelerator default_device;
     std::wcout << L"Using device : " << default_device.get_description() << std::endl;
@@ -247,19 +239,15 @@ int main()
     assert((M!=0) && (W!=0) && (N!=0));
 
     printf("Matrix dimension C(%d x %d) = A(%d x %d) * B(%d x %d)\n", M, W, M, N, N, W);
-    printf("CPU(single core) exec ");
-	std::cout << time_call([&] { mxm_single_cpu(M, N, W, v_a, v_b, v_ref); });
-    printf("ms.\n");
-
-    printf("AMP Simple ");
-	std::cout << time_call([&] {mxm_amp_simple(M, N, W, v_a, v_b, v_c_simple); });
-    printf("ms.\n");
-    printf("\t%s\n\n", verify(v_c_simple, v_ref, M * W) ? "Data matches" : "Data mismatch");
-
-    printf("AMP Tiled ");
-	std::cout << time_call([&] {mxm_amp_tiled<DATA_TYPE, 16>(M, N, W, v_a, v_b, v_c_tiled); });
-    printf("ms.\n");
-    printf("\t%s\n\n", verify(v_c_tiled, v_ref, M * W) ? "Data matches" : "Data mismatch");
+    dx::bench::suite suite("matrixmult");
+    suite.add_serial("CPU(single core)", [&] { mxm_single_cpu(M, N, W, v_a, v_b, v_ref); });
+    suite.add_serial("AMP Simple", [&] { mxm_amp_simple(M, N, W, v_a, v_b, v_c_simple); });
+    suite.add_serial("AMP Tiled", [&] { mxm_amp_tiled<DATA_TYPE, 16>(M, N, W, v_a, v_b, v_c_tiled); });
+    if (int rc = suite.run(argc, argv))
+        return rc;
+
+    printf("AMP Simple\t%s\n", verify(v_c_simple, v_ref, M * W) ? "Data matches" : "Data mismatch");
+    printf("AMP Tiled\t%s\n\n", verify(v_c_tiled, v_ref, M * W) ? "Data matches" : "Data mismatch");
 
     return 0;
 }
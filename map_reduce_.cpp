@@ -1,9 +1,14 @@
 // parallel-fibonacci.cpp 
 // compile with: /EHsc
-#include <windows.h>
-#include <ppl.h>
-#include <concurrent_vector.h>
-#include <ppltasks.h> // for task
+#include "dx/platform.h"
+#include "dx/ppl.h"
+#include "dx/concurrent_vector.h"
+#include "dx/task.h" // for task
+#include "dx/task_graph.h"
+#include "dx/sieve.h"
+#include "dx/mapped_reduce.h"
+#include "dx/pipeline.h"
+#include "dx/bench.h"
 #include <array>
 #include <vector>
 #include <tuple>
@@ -11,20 +16,15 @@
 #include <sstream>
 #include <iostream>
 #include <numeric>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include "inttypes.h" // For Printf Macros(PRId64,etc)
-using namespace concurrency;
+using namespace dx;
 using namespace std;
 
-// Calls the provided work function and returns the number of milliseconds  
-// that it takes to call that function. 
-template <class Function>
-__int64 time_call(Function&& f)
-{
-	__int64 begin = GetTickCount64();
-	f();
-	return GetTickCount64() - begin;
-}
-
 void test_task()
 {
 	array<task<int>, 3> tasks =
@@ -48,6 +48,62 @@ void test_task()
 	joinTask.wait();
 }
 
+// Results of the benchmarks, printed once the suite has run.
+vector<function<void()>> reports;
+
+// Compares the per-request latency of the create_task/when_all/then
+// fan-out in test_task with the same graph built once and replayed.
+void test_task_latency(bench::suite& suite)
+{
+	const int requests = 10000;
+	auto total = make_shared<int>(0);
+
+	suite.group("task latency");
+	suite.add("task x10000", [total] { *total = 0; }, [=] {
+		for (int r = 0; r < requests; ++r)
+		{
+			array<task<int>, 3> tasks =
+			{
+				create_task([r]() -> int { return r + 88; }),
+				create_task([r]() -> int { return r + 42; }),
+				create_task([r]() -> int { return r + 99; })
+			};
+			auto joinTask = when_all(begin(tasks), end(tasks)).then([](vector<int> results)
+			{
+				return accumulate(begin(results), end(results), 0);
+			});
+			*total += joinTask.get();
+		}
+	});
+
+	struct graph
+	{
+		task_graph g;
+		graph_node<int> request = g.input<int>();
+		graph_node<int> join = g.when_all({
+			request.then([](int r) { return r + 88; }),
+			request.then([](int r) { return r + 42; }),
+			request.then([](int r) { return r + 99; }) }).then([](const graph_results<int>& results)
+		{
+			return accumulate(begin(results), end(results), 0);
+		});
+	};
+	auto g = make_shared<graph>();
+	auto graph_total = make_shared<int>(0);
+	suite.add("task_graph x10000", [graph_total] { *graph_total = 0; }, [=] {
+		for (int r = 0; r < requests; ++r)
+		{
+			g->request.set(r);
+			g->g.run();
+			*graph_total += g->join.get();
+		}
+	});
+
+	reports.push_back([=] {
+		cout << "task total: " << *total << ", task_graph total: " << *graph_total << endl;
+	});
+}
+
 // Determines whether the input value is prime. 
 bool is_prime(int n)
 {
@@ -61,82 +117,125 @@ bool is_prime(int n)
 	return true;
 }
 
-void test_map_recude()
+void test_map_recude(bench::suite& suite)
 {
-#ifdef USE_REDUCE // Use parallel_reduce
 	// Create an array object that contains 200000 integers. 
-	array<int, 200000> a;
+	auto a = make_shared<array<int, 200000>>();
 
 	// Initialize the array such that a[i] == i.
-	iota(begin(a), end(a), 0);
-
-	int prime_sum;
-	__int64 elapsed;
+	auto init = [a] { iota(begin(*a), end(*a), 0); };
+	init();
 
+	auto prime_sum = make_shared<long long>(0);
+	suite.group("prime sum");
+#ifdef USE_REDUCE // Use parallel_reduce
 	// Compute the sum of the numbers in the array that are prime.
-	elapsed = time_call([&] {
-		transform(begin(a), end(a), begin(a), [](int i) {
+	suite.add_serial("serial", init, [=] {
+		transform(begin(*a), end(*a), begin(*a), [](int i) {
 			return is_prime(i) ? i : 0;
 		});
-		prime_sum = accumulate(begin(a), end(a), 0);
+		*prime_sum = accumulate(begin(*a), end(*a), 0LL);
 	});
-	cout << prime_sum << endl;
-	
-	cout << "serial time: " << elapsed
-		<< " ms" << endl << endl;
 
 	// Now perform the same task in parallel.
-	elapsed = time_call([&] {
-		parallel_transform(begin(a), end(a), begin(a), [](int i) {
+	suite.add("parallel", init, [=] {
+		parallel_transform(begin(*a), end(*a), begin(*a), [](int i) {
 			return is_prime(i) ? i : 0;
 		});
-		prime_sum = parallel_reduce(begin(a), end(a), 0);
+		// Sums into 64 bits on the vectorized kernels.
+		*prime_sum = parallel_reduce(begin(*a), end(*a), 0LL);
 	});
-	cout << prime_sum << endl;
-	
-	cout << "parallel time: "<< elapsed
-		<< " ms" << endl << endl;
 #else
-	// Create an array object that contains 200000 integers. 
-	array<int, 200000> a;
-
-	// Initialize the array such that a[i] == i.
-	iota(begin(a), end(a), 0);
-
-	int prime_sum;
-	__int64 elapsed;
-
 	// Compute the sum of the numbers in the array that are prime.
-	elapsed = time_call([&] {
-		prime_sum = accumulate(begin(a), end(a), 0, [&](int acc, int i) {
+	suite.add_serial("serial", [=] {
+		*prime_sum = accumulate(begin(*a), end(*a), 0, [&](int acc, int i) {
 			return acc + (is_prime(i) ? i : 0);
 		});
 	});
-	wcout << prime_sum << endl;
-	wcout << "serial time: " << elapsed << " ms" << endl << endl;
 
 	// Now perform the same task in parallel.
-	elapsed = time_call([&] {
+	suite.add("parallel", [=] {
 		combinable<int> sum;
-		parallel_for_each(begin(a), end(a), [&](int i) {
+		parallel_for_each(begin(*a), end(*a), [&](int i) {
 			sum.local() += (is_prime(i) ? i : 0);
 		});
 
-		prime_sum = sum.combine(plus<int>());
+		*prime_sum = sum.combine(plus<int>());
 	});
-	wcout << prime_sum << endl;
-	wcout << "parallel time: " << elapsed << " ms" << endl << endl;
 #endif 
 
+	// One fused pass: the transform feeds the sum in registers instead of
+	// writing back into a for a second pass to read.
+	auto pipeline_sum = make_shared<long long>(0);
+	suite.add("pipeline", [=] {
+		*pipeline_sum = pipe::source(*a)
+			| pipe::transform([](int i) { return is_prime(i) ? (long long)i : 0LL; })
+			| pipe::reduce(0LL, plus<long long>());
+	});
+
+	// Sieve the range [0, a.size()) instead of testing every element.
+	auto sieve_sum = make_shared<long long>(0);
+	suite.add("sieve", [=] {
+		*sieve_sum = (long long)dx::prime_sum(0, a->size());
+	});
+
+	reports.push_back([=] {
+		cout << "prime sum: " << *prime_sum << ", pipeline: " << *pipeline_sum << ", sieve: " << *sieve_sum << endl;
+	});
+}
+
+// Runs the same prime-sum pipeline over a file of native ints that is
+// mapped a chunk at a time. Without a path, writes the 200000-element
+// input of test_map_recude to a temporary file first.
+void test_mapped_reduce(bench::suite& suite, const char* path)
+{
+	string file = path ? path : "map_reduce.bin";
+	if (!path)
+	{
+		vector<int> a(200000);
+		iota(begin(a), end(a), 0);
+		ofstream(file, ios::binary).write(reinterpret_cast<const char*>(a.data()), a.size() * sizeof(int));
+	}
+
+	auto prime_sum = make_shared<long long>(0);
+	suite.group("mapped file");
+	suite.add("mapped_reduce", [=] {
+		*prime_sum = mapped_reduce<int>(file, 0LL, [](int i) {
+			return is_prime(i) ? (long long)i : 0LL;
+		}, plus<long long>());
+	});
+
+	reports.push_back([=] {
+		cout << "mapped file prime sum: " << *prime_sum << endl;
+		if (!path)
+			remove(file.c_str());
+	});
 }
 
-int main()
+// Usage: map_reduce_ [input-file] [benchmark options, see dx/bench.h]
+int main(int argc, char* argv[])
 {
 	//__int64 i = 0x7fffffffffffffff;
 	//std::cout << sizeof(__int64) << '\n' << i << std::endl;
 	//printf("%" PRId64 "\t\n", i);
 	//printf("%llx\n", i); // PRIx64
 
-	test_map_recude();
-	return 0;
-}
\ No newline at end of file
+	const char* path = nullptr;
+	if (argc > 1 && strncmp(argv[1], "--", 2) != 0)
+	{
+		path = argv[1];
+		argv[1] = argv[0];
+		--argc;
+		++argv;
+	}
+
+	// The trial-division benchmarks take seconds each.
+	bench::suite suite("map_reduce", 1, 3);
+	test_map_recude(suite);
+	test_task_latency(suite);
+	test_mapped_reduce(suite, path);
+	int rc = suite.run(argc, argv);
+	for (auto& report : reports)
+		report();
+	return rc;
+}
@@ -1,10 +1,11 @@
 // parallel-bitonic-sort.cpp 
 // compile with: /EHsc
-#include <windows.h>
 #include <algorithm>
 #include <iostream>
 #include <random>
-#include <ppl.h>
+#include "dx/ppl.h"
+#include "dx/bench.h"
+#include "dx/bitonic_sort.h"
 
 //p ָCPU
 //T_1 ָ˳ִ㷨ִʱ
@@ -14,151 +15,88 @@
 // ЧʣE = 1ʱΪԼv:p = Sp
 // efficiency: E = Sp / p
 
-using namespace concurrency;
+using namespace dx;
 using namespace std;
 
-// Calls the provided work function and returns the number of milliseconds  
-// that it takes to call that function. 
-template <class Function>
-__int64 time_call(Function&& f)
-{
-   __int64 begin = GetTickCount();
-   f();
-   return GetTickCount() - begin;
-}
-
-const bool INCREASING = true;
-const bool DECREASING = false;
+int main(int argc, char* argv[])
+{  
+   // Any size works; 1000000 is not a power of two.
+   const int sizes[] = { 1024 * 1024, 1000000, 64 * 1024 * 1024 };
+   const char* labels[] = { "1M", "1000000", "64M" };
+   const int count = sizeof(sizes) / sizeof(sizes[0]);
 
-// Comparator function for the bitonic sort algorithm. 
-template <class T>
-void compare(T* items, int i, int j, bool dir)
-{
-   if (dir == (items[i] > items[j]))
+   // Fill the inputs with random values; every trial sorts a fresh copy.
+   vector<int> input[count], a[count];
+   mt19937 gen(42);
+   bench::suite suite("parallel_bitonic_sort", 1, 3);
+   for (int s = 0; s < count; ++s)
    {
-      swap(items[i], items[j]);
+      const int size = sizes[s];
+      input[s].resize(size);
+      for(int i = 0; i < size; ++i)
+      {
+         input[s][i] = gen();
+      }
+      vector<int>& items = a[s];
+      auto reset = [&input, &items, s] { items = input[s]; };
+      string label = string(" ") + labels[s];
+      suite.group(labels[s]);
+      suite.add_serial("bitonic_sort" + label, reset, [&items, size] { bitonic_sort(items.data(), size); });
+      suite.add("parallel_bitonic_sort" + label, reset, [&items, size] { parallel_bitonic_sort(items.data(), size); });
    }
-}
 
-// Sorts a bitonic sequence in the specified order. 
-template <class T>
-void bitonic_merge(T* items, int lo, int n, bool dir)
-{
-   if (n > 1)
+   // Record ids sorted by a key: as a key array with an id payload, and as
+   // key/id structs ordered by a projection.
+   struct record
    {
-      int m = n / 2;
-      for (int i = lo; i < lo + m; ++i)
+      int key;
+      int id;
+   };
+   const int size = sizes[0];
+   vector<int> keys, ids;
+   vector<record> records;
+   auto reset_keys = [&] {
+      keys = input[0];
+      ids.resize(size);
+      for (int i = 0; i < size; ++i)
       {
-         compare(items, i, i + m, dir);
+         ids[i] = i;
       }
-      bitonic_merge(items, lo, m, dir);
-      bitonic_merge(items, lo + m, m, dir);
-   }
-}
-
-// Sorts the given sequence in the specified order. 
-template <class T>
-void bitonic_sort(T* items, int lo, int n, bool dir)
-{
-   if (n > 1)
+   };
+   auto reset_records = [&] {
+      records.resize(size);
+      for (int i = 0; i < size; ++i)
+      {
+         records[i] = record{ input[0][i], i };
+      }
+   };
+   auto key = [](const record& r) { return r.key; };
+   suite.group("1M key/value");
+   suite.add_serial("bitonic_sort keys+ids", reset_keys, [&] { bitonic_sort(keys.data(), ids.data(), size); });
+   suite.add("parallel_bitonic_sort keys+ids", reset_keys, [&] { parallel_bitonic_sort(keys.data(), ids.data(), size); });
+   suite.add("parallel_bitonic_sort records", reset_records, [&] { parallel_bitonic_sort(records.data(), size, key); });
+
+   int rc = suite.run(argc, argv);
+   for (int s = 0; s < count; ++s)
    {
-      // Divide the array into two partitions and then sort  
-      // the partitions in different directions. 
-      int m = n / 2;
-      bitonic_sort(items, lo, m, INCREASING);
-      bitonic_sort(items, lo + m, m, DECREASING);
-
-      // Merge the results.
-      bitonic_merge(items,lo, n, dir);
+      if (!a[s].empty())
+      {
+         cout << labels[s] << ": " << (is_sorted(a[s].begin(), a[s].end()) ? "sorted" : "NOT sorted") << endl;
+      }
    }
-}
-
-// Sorts the given sequence in increasing order. 
-template <class T>
-void bitonic_sort(T* items, int size)
-{
-    bitonic_sort(items, 0, size, INCREASING);
-}
-
-// Sorts a bitonic sequence in the specified order. 
-template <class T>
-void parallel_bitonic_merge(T* items, int lo, int n, bool dir)
-{   
-   // Merge the sequences concurrently if there is sufficient work to do. 
-   if (n > 500)
+   if (!keys.empty())
    {
-      int m = n / 2;
-      for (int i = lo; i < lo + m; ++i)
+      bool ok = is_sorted(keys.begin(), keys.end());
+      for (int i = 0; ok && i < size; ++i)
       {
-         compare(items, i, i + m, dir);
+         ok = input[0][ids[i]] == keys[i];
       }
-
-      // Use the parallel_invoke algorithm to merge the sequences in parallel.
-      parallel_invoke(
-         [&items,lo,m,dir] { parallel_bitonic_merge(items, lo, m, dir); },
-         [&items,lo,m,dir] { parallel_bitonic_merge(items, lo + m, m, dir); }
-      );
+      cout << "keys+ids: " << (ok ? "sorted" : "NOT sorted") << endl;
    }
-   // Otherwise, perform the work serially. 
-   else if (n > 1)
+   if (!records.empty())
    {
-      bitonic_merge(items, lo, n, dir);
-   }   
-}
-
-// Sorts the given sequence in the specified order. 
-template <class T>
-void parallel_bitonic_sort(T* items, int lo, int n, bool dir)
-{   
-   if (n > 1)
-   {
-      // Divide the array into two partitions and then sort  
-      // the partitions in different directions. 
-      int m = n / 2;
-
-      // Sort the partitions in parallel.
-      parallel_invoke(
-         [&items,lo,m] { parallel_bitonic_sort(items, lo, m, INCREASING); },
-         [&items,lo,m] { parallel_bitonic_sort(items, lo + m, m, DECREASING); }
-      );
-
-      // Merge the results.
-      parallel_bitonic_merge(items, lo, n, dir);
+      bool ok = is_sorted(records.begin(), records.end(), [](const record& a, const record& b) { return a.key < b.key; });
+      cout << "records: " << (ok ? "sorted" : "NOT sorted") << endl;
    }
+   return rc;
 }
-
-// Sorts the given sequence in increasing order. 
-template <class T>
-void parallel_bitonic_sort(T* items, int size)
-{
-   parallel_bitonic_sort(items, 0, size, INCREASING);
-}
-
-int main()
-{  
-   // For this example, the size must be a power of two. 
-   const int size = 1024 * 1024;
-
-   // Create two large arrays and fill them with random values. 
-   int* a1 = new int[size];
-   int* a2 = new int[size];
-
-   mt19937 gen(42);
-   for(int i = 0; i < size; ++i)
-   {
-      a1[i] = a2[i] = gen();
-   }
-
-   __int64 elapsed;
-
-   // Perform the serial version of the sort.
-   elapsed = time_call([&] { bitonic_sort(a1, size); });
-   wcout << "serial time: " << elapsed << endl;
-
-   // Now perform the parallel version of the sort.
-   elapsed = time_call([&] { parallel_bitonic_sort(a2, size); });
-   wcout << "parallel time: " << elapsed << endl;
-
-   delete[] a1;
-   delete[] a2;
-}
\ No newline at end of file
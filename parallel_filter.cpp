@@ -1,4 +1,3 @@
-#include <windows.h>
 #include <algorithm>
 #include <iostream>
 #include <random>
@@ -7,22 +6,18 @@
 #include <iterator>
 #include <numeric>
 #include <list>
-#include <ppl.h>
-#include <concurrent_vector.h>
-#include <ppltasks.h> // for task
+#include <cstdint>
+#include <type_traits>
+#include "dx/ppl.h"
+#include "dx/partition.h"
+#include "dx/pipeline.h"
+#include "dx/spf.h"
+#include "dx/bench.h"
+#include "dx/task.h" // for task
 
-using namespace concurrency;
+using namespace dx;
 using namespace std;
 
-template <class Function>
-inline
-__int64 time_call(Function&& f)
-{
-	__int64 begin = GetTickCount64();
-	f();
-	return GetTickCount64() - begin;
-}
-
 // Determines whether the input value is prime. 
 bool is_prime(int n)
 {
@@ -57,34 +52,103 @@ inline bool is_carmichael(const int n)
 	}
 	return k != n && (n - 1) % (k - 1) == 0;
 }
-// Sorts the given sequence in the specified order. 
-template <class _Iter, class _OutTy, typename _Pred>
-inline void parallel_copy_if(_Iter _beg, _Iter _end, _OutTy _to, _Pred &&flt)
+// Whether parallel_copy_if keeps the predicate results of its counting
+// pass for the writing pass, one bit per element, instead of calling the
+// predicate twice on every element. Worth it for predicates that cost more
+// than reading a bit, such as is_carmichael.
+enum class predicate_cache
+{
+	none,
+	bitmask
+};
+
+// Stable stream compaction in two passes over chunks of the input: the
+// first counts the matches of each chunk, a prefix sum of the counts gives
+// each chunk its offset in the output, and the second writes every chunk's
+// matches straight to its place. The output is in input order, and nothing
+// is gathered in between. destination(total) returns the random-access
+// iterator the matches go to once their number is known.
+template <class _Iter, class _Pred, class _Destination>
+auto copy_if_compact(_Iter _beg, _Iter _end, _Pred& flt, predicate_cache cache, _Destination destination)
 {
-	typedef typename _Iter::value_type T;
+	static_assert(std::is_base_of<std::random_access_iterator_tag,
+		typename std::iterator_traits<_Iter>::iterator_category>::value, "parallel_copy_if needs random-access input");
+	const size_t n = size_t(_end - _beg);
+	const size_t p = scheduler::instance().concurrency();
 
-#ifndef _COMBINE
-	combinable<vector<T> > cache;
-	parallel_for_each(_beg, _end, [&](T i) {
-		if (flt(i))
-			cache.local().push_back(i);
+	// About eight chunks per worker, in whole bitmask words so no two
+	// chunks write the same word.
+	size_t chunk = max<size_t>(1024, n / (8 * p));
+	chunk = (chunk + 63) / 64 * 64;
+	const size_t chunks = (n + chunk - 1) / chunk;
+	vector<size_t> offsets(chunks + 1, 0);
+	vector<uint64_t> bits(cache == predicate_cache::bitmask ? (n + 63) / 64 : 0);
+	const bool cached = !bits.empty();
+
+	parallel_for(size_t(0), chunks, [&](size_t c) {
+		size_t first = c * chunk, last = min(n, first + chunk), count = 0;
+		for (size_t i = first; i < last; ++i)
+		{
+			if (flt(_beg[i]))
+			{
+				++count;
+				if (cached)
+					bits[i / 64] |= uint64_t(1) << (i % 64);
+			}
+		}
+		offsets[c + 1] = count;
 	});
-	cache.combine_each([&](vector<T> &local) {
-		std::move(local.begin(), local.end(), _to);
+	partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+	auto _to = destination(offsets[chunks]);
+	parallel_for(size_t(0), chunks, [&](size_t c) {
+		size_t first = c * chunk, last = min(n, first + chunk);
+		auto out = _to + offsets[c];
+		for (size_t i = first; i < last; ++i)
+		{
+			if (cached ? (bits[i / 64] >> (i % 64)) & 1 : flt(_beg[i]))
+				*out++ = _beg[i];
+		}
 	});
-	
-#else
-	concurrent_vector<T> cache;
+	return _to + offsets[chunks];
+}
+
+// The container a back_insert_iterator appends to.
+template <class _Container>
+_Container& container_of(const back_insert_iterator<_Container>& it)
+{
+	struct access : back_insert_iterator<_Container>
+	{
+		static _Container* get(const back_insert_iterator<_Container>& i) { return i.*(&access::container); }
+	};
+	return *access::get(it);
+}
+
+// Copies the elements of [_beg, _end) that satisfy flt to _to, in input
+// order, and returns the end of the output. _to is a random-access
+// iterator with room for the matches.
+template <class _Iter, class _OutIt, typename _Pred>
+inline _OutIt parallel_copy_if(_Iter _beg, _Iter _end, _OutIt _to, _Pred &&flt,
+	predicate_cache cache = predicate_cache::none)
+{
+	return copy_if_compact(_beg, _end, flt, cache, [&](size_t) { return _to; });
+}
 
-	parallel_for_each(_beg, _end, [&](T i) {
-		if (flt(i))
-			cache.push_back(i);
+// Appending form: the container grows once, by the number of matches.
+template <class _Iter, class _Container, typename _Pred>
+inline back_insert_iterator<_Container> parallel_copy_if(_Iter _beg, _Iter _end,
+	back_insert_iterator<_Container> _to, _Pred &&flt, predicate_cache cache = predicate_cache::none)
+{
+	_Container& c = container_of(_to);
+	const size_t old = c.size();
+	copy_if_compact(_beg, _end, flt, cache, [&](size_t total) {
+		c.resize(old + total);
+		return c.begin() + old;
 	});
-	std::move(cache.begin(), cache.end(), _to);
-#endif // use combine class
+	return _to;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	array<int, 250000> a;
 	vector<int> prime_numbers;
@@ -92,21 +156,90 @@ int main()
 	// Initialize the array such that a[i] == i.
 	iota(begin(a), end(a), 100);
 
-	cout << "copy_if used " << time_call([&](){
+	auto reset = [&] { prime_numbers.clear(); };
+	bench::suite suite("parallel_filter");
+	suite.add_serial("copy_if", reset, [&] {
 		copy_if(begin(a), end(a), std::back_inserter(prime_numbers), is_carmichael);
-	}) << "ms\n";
-	cout << prime_numbers.size();	
-	cout << ":[";
-	for_each(prime_numbers.begin(), prime_numbers.end(), [](int x){ cout << x << ','; });
-	cout << "\n";
-	
-	prime_numbers.clear();
-	cout << "parallel_copy_if used " << time_call([&](){
+	});
+	suite.add("parallel_copy_if", reset, [&] {
 		parallel_copy_if(begin(a), end(a), std::back_inserter(prime_numbers), is_carmichael);
-		parallel_sort(prime_numbers.begin(), prime_numbers.end());
-	}) << "ms\n";
+	});
+	suite.add("parallel_copy_if bitmask", reset, [&] {
+		parallel_copy_if(begin(a), end(a), std::back_inserter(prime_numbers), is_carmichael,
+			predicate_cache::bitmask);
+	});
+
+	// Factor with a smallest-prime-factor table of the range instead of by
+	// trial division, or sieve the range for Korselt's criterion directly.
+	// Both include building their tables.
+	vector<int> table_numbers;
+	vector<uint32_t> sieved_numbers;
+	suite.add("parallel_copy_if spf_table", [&] {
+		table_numbers.clear();
+		const spf_table spf(uint64_t(a.back()) + 1);
+		parallel_copy_if(begin(a), end(a), std::back_inserter(table_numbers), [&spf](int n) {
+			return n >= 0 && spf.is_carmichael(uint32_t(n));
+		});
+	});
+	suite.add("carmichael_numbers", [&] {
+		sieved_numbers = carmichael_numbers(uint64_t(a.front()), uint64_t(a.back()) + 1);
+	});
+
+	// The same split in place: Carmichael numbers first, the rest after.
+	// The stable split has its own vector for the order check.
+	vector<int> split, stable_split;
+	auto reset_split = [&] { split.assign(begin(a), end(a)); };
+	auto reset_stable_split = [&] { stable_split.assign(begin(a), end(a)); };
+	suite.group("split in place");
+	suite.add_serial("stable_partition", reset_split, [&] {
+		std::stable_partition(begin(split), end(split), is_carmichael);
+	});
+	suite.add("parallel_partition", reset_split, [&] {
+		parallel_partition(begin(split), end(split), is_carmichael);
+	});
+	suite.add("parallel_stable_partition", reset_stable_split, [&] {
+		parallel_stable_partition(begin(stable_split), end(stable_split), is_carmichael);
+	});
+
+	// Sum of the Carmichael numbers: materialize the matches and reduce
+	// them in a second pass, or filter straight into the sum.
+	long long carmichael_sum = 0, pipeline_sum = 0;
+	vector<int> matches;
+	suite.group("carmichael sum");
+	suite.add_serial("copy_if + accumulate", [&] {
+		matches.clear();
+		copy_if(begin(a), end(a), std::back_inserter(matches), is_carmichael);
+		carmichael_sum = accumulate(matches.begin(), matches.end(), 0LL);
+	});
+	suite.add("parallel_copy_if + parallel_reduce", [&] {
+		matches.clear();
+		parallel_copy_if(begin(a), end(a), std::back_inserter(matches), is_carmichael);
+		carmichael_sum = parallel_reduce(matches.begin(), matches.end(), 0LL);
+	});
+	suite.add("pipeline", [&] {
+		pipeline_sum = pipe::source(a)
+			| pipe::filter(is_carmichael)
+			| pipe::transform([](int n) { return (long long)n; })
+			| pipe::reduce(0LL, plus<long long>());
+	});
+	int rc = suite.run(argc, argv);
+
+	vector<int> expected;
+	copy_if(begin(a), end(a), std::back_inserter(expected), is_carmichael);
+	if (!prime_numbers.empty() && prime_numbers != expected)
+		cout << "parallel_copy_if: NOT in input order\n";
+	if (!stable_split.empty() && !equal(expected.begin(), expected.end(), stable_split.begin()))
+		cout << "parallel_stable_partition: NOT in input order\n";
+	if (pipeline_sum != 0 && pipeline_sum != accumulate(expected.begin(), expected.end(), 0LL))
+		cout << "pipeline: sum differs\n";
+	if (!table_numbers.empty() && table_numbers != expected)
+		cout << "spf_table: differs from is_carmichael\n";
+	if (!sieved_numbers.empty() && !equal(expected.begin(), expected.end(), sieved_numbers.begin(), sieved_numbers.end()))
+		cout << "carmichael_numbers: differs from is_carmichael\n";
+
 	cout << prime_numbers.size();
 	cout << ":[";
 	for_each(prime_numbers.begin(), prime_numbers.end(), [](int x){ cout << x << ','; });
 	cout << "]\n";
+	return rc;
 }
\ No newline at end of file
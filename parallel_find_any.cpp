@@ -1,48 +1,21 @@
-#include <Windows.h>
 #include <algorithm>
 #include <iostream>
 #include <random>
-#include <ppl.h>
+#include <unordered_map>
+#include "dx/ppl.h"
+#include "dx/find.h"
+#include "dx/batch_find.h"
+#include "dx/bench.h"
 
-using namespace concurrency;
+using namespace dx;
 using namespace std;
 
-// Calls the provided work function and returns the number of milliseconds  
-// that it takes to call that function. 
-template <class Function, typename R = result_of<Function()>::type>
-inline R time_call(Function&& f)
-{
-	__int64 begin = GetTickCount();
-	R r =  f();
-	cout << (GetTickCount() - begin) << "ms\n";
-	return r;
-}
-
-// Returns the position in the provided array that contains the given value,  
-// or -1 if the value is not in the array. 
+// Returns the position in the provided array of some element that
+// satisfies f, or _Last if none does.
 template<typename _Iter, typename P>
 inline _Iter parallel_find_if_any(_Iter _First, _Iter _Last, P &&f)
 {
-	// The position of the element in the array.  
-	// The default value, -1, indicates that the element is not in the array. 
-	int position = -1;
-	size_t count = std::distance(_First, _Last);
-	// Call parallel_for in the context of a cancellation token to search for the element.
-	// Call parallel_for in the context of a cancellation token to search for the element.
-	cancellation_token_source cts;
-	run_with_cancellation_token([count, &f, &_First, &position, &cts]()
-	{
-		parallel_for(std::size_t(0), count, [&f, &_First, &position, &cts](int n) {
-			if (f(*(_First + n)))
-			{
-				// Set the return value and cancel the remaining tasks.
-				position = n;
-				cts.cancel();
-			}
-		});
-	}, cts.get_token());
-
-	return position < 0 ? _Last : _First + position;
+	return parallel_find_any(_First, _Last, f);
 }
 
 // Determines whether the input value is prime. 
@@ -79,36 +52,159 @@ inline bool is_carmichael(const int n)
 	return k != n && (n - 1) % (k - 1) == 0;
 }
 // main entry.
-int main()
+int main(int argc, char* argv[])
 {
 	// For this example, the size must be a power of two. 
 	const int size = 0x200000;
 
-	// Create two large arrays and fill them with random values. 
-	int* a1 = new int[size];
-	int* a2 = new int[size];
+	// Create a large array and fill it with random values. 
+	vector<int> a(size);
 
 	mt19937 gen(42);
 	for (int i = 0; i < size; ++i)
 	{
-		a1[i] = a2[i] = gen();
+		a[i] = gen();
 	}
-	
-	// Perform the serial version of the sort.
-	wcout << "serial time: ";
-	auto p1 = time_call([&] {
-		return std::find_if(a1, a1 + size, is_carmichael);
+
+	int* p1 = nullptr;
+	int* p2 = nullptr;
+	int* p3 = nullptr;
+	// Each search takes seconds, so a few trials without warm-up suffice.
+	bench::suite suite("parallel_find_any", 0, 3);
+	// The serial version of the search.
+	suite.add_serial("find_if", [&] {
+		p1 = std::find_if(a.data(), a.data() + size, is_carmichael);
+	});
+	// The parallel version of the find_if_any.
+	suite.add("parallel_find_if_any", [&] {
+		p2 = parallel_find_if_any(a.data(), a.data() + size, is_carmichael);
+	});
+	// The leftmost match, as find_if returns it.
+	suite.add("parallel_find_first", [&] {
+		p3 = parallel_find_first(a.data(), a.data() + size, is_carmichael);
 	});
-	cout << "[" << p1 - a1 << "]" << *p1 << endl;
 
-	// Now perform the parallel version of the find_if_any.
-	wcout << "parallel time: ";
-	auto p2 = time_call([&] {
-		return parallel_find_if_any(a2, a2 + size, is_carmichael);
+	// Early exits with a cheap predicate: a match near the front, which the
+	// parallel searches should find in microseconds, and one near the back.
+	const int early = a[1000], late = a[size - 1000];
+	vector<int> b(a);
+	b[size - 1000] ^= 1;
+	int* early_first = nullptr;
+	int* late_first = nullptr;
+	int* late_last = nullptr;
+	int* mismatch_at = nullptr;
+	ptrdiff_t negatives = -1;
+	suite.group("cheap");
+	suite.add_serial("find_if early", [&] {
+		early_first = find_if(a.data(), a.data() + size, [=](int x) { return x == early; });
+	});
+	suite.add("parallel_find_first early", [&] {
+		early_first = parallel_find_first(a.data(), a.data() + size, [=](int x) { return x == early; });
+	});
+	suite.add("parallel_any_of early", [&] {
+		parallel_any_of(a.begin(), a.end(), [=](int x) { return x == early; });
+	});
+	suite.add("parallel_all_of early", [&] {
+		parallel_all_of(a.begin(), a.end(), [=](int x) { return x != early; });
+	});
+	suite.add_serial("find_if late", [&] {
+		late_first = find_if(a.data(), a.data() + size, [=](int x) { return x == late; });
+	});
+	suite.add("parallel_find_first late", [&] {
+		late_first = parallel_find_first(a.data(), a.data() + size, [=](int x) { return x == late; });
 	});
-	cout << "[" << p2 - a2 << "]" << *p2 << endl;	
+	suite.add("parallel_find_last late", [&] {
+		late_last = parallel_find_last(a.data(), a.data() + size, [=](int x) { return x == late; });
+	});
+	suite.add("parallel_mismatch late", [&] {
+		mismatch_at = parallel_mismatch(a.data(), a.data() + size, b.data()).first;
+	});
+	suite.add_serial("count_if", [&] { negatives = count_if(a.begin(), a.end(), [](int x) { return x < 0; }); });
+	suite.add("parallel_count_if", [&] {
+		negatives = parallel_count_if(a.begin(), a.end(), [](int x) { return x < 0; });
+	});
+
+	// Many keys against the same array in one pass: half of them taken from
+	// the array, half random and most likely absent.
+	auto make_keys = [&](size_t count) {
+		vector<int> keys(count);
+		mt19937 kgen(7);
+		for (size_t k = 0; k < count; ++k)
+			keys[k] = k % 2 ? a[kgen() % size] : int(kgen());
+		return keys;
+	};
+	const vector<int> few = make_keys(16), many = make_keys(4096);
+	vector<int*> few_serial, few_batch, many_serial, many_batch;
+	suite.group("batch");
+	suite.add_serial("find x16", [&] {
+		few_serial.clear();
+		for (int key : few)
+			few_serial.push_back(find(a.data(), a.data() + size, key));
+	});
+	suite.add("parallel_find_first_of_each x16", [&] {
+		few_batch = parallel_find_first_of_each(a.data(), a.data() + size, few.begin(), few.end());
+	});
+	suite.add_serial("unordered_map pass x4096", [&] {
+		unordered_map<int, int*> first_at;
+		for (int key : many)
+			first_at.emplace(key, a.data() + size);
+		for (int* p = a.data() + size; p-- != a.data();)
+		{
+			auto it = first_at.find(*p);
+			if (it != first_at.end())
+				it->second = p;
+		}
+		many_serial.clear();
+		for (int key : many)
+			many_serial.push_back(first_at[key]);
+	});
+	suite.add("parallel_find_first_of_each x4096", [&] {
+		many_batch = parallel_find_first_of_each(a.data(), a.data() + size, many.begin(), many.end());
+	});
+	int rc = suite.run(argc, argv);
+
+	auto report = [&](const char* name, int* p) {
+		cout << name << ": [" << p - a.data() << "]";
+		if (p != a.data() + size)
+			cout << *p;
+		else
+			cout << "not found";
+		cout << endl;
+	};
+	report("serial", p1);
+	report("parallel", p2);
+	report("parallel first", p3);
+	if (p1 && p3 && p1 != p3)
+		cout << "parallel_find_first: differs from find_if" << endl;
+	auto check = [&](const char* name, int* got, int* expected) {
+		if (got && got != expected)
+			cout << name << ": wrong position" << endl;
+	};
+	check("parallel_find_first early", early_first, find(a.data(), a.data() + size, early));
+	check("parallel_find_first late", late_first, find(a.data(), a.data() + size, late));
+	check("parallel_find_last late", late_last, find_end(a.data(), a.data() + size, &late, &late + 1));
+	check("parallel_mismatch late", mismatch_at, mismatch(a.data(), a.data() + size, b.data()).first);
+	if (!few_serial.empty() && !few_batch.empty() && few_serial != few_batch)
+		cout << "parallel_find_first_of_each x16: wrong positions" << endl;
+	if (!many_serial.empty() && !many_batch.empty() && many_serial != many_batch)
+		cout << "parallel_find_first_of_each x4096: wrong positions" << endl;
+	vector<int> none;
+	if (parallel_find_first_of_each(none.begin(), none.end(), few.begin(), few.end())
+		!= vector<vector<int>::iterator>(few.size(), none.end()))
+		cout << "parallel_find_first_of_each empty: wrong positions" << endl;
+	if (negatives >= 0 && negatives != count_if(a.begin(), a.end(), [](int x) { return x < 0; }))
+		cout << "parallel_count_if: wrong count" << endl;
 
-	delete[] a1;
-	delete[] a2;
-	return 0;
-}
\ No newline at end of file
+	// find_end calls pred(element, pattern element), as std::find_end does;
+	// an asymmetric predicate over two types tells the orders apart.
+	vector<int> digits(100000);
+	mt19937 digit_gen(7);
+	for (int& d : digits)
+		d = int(digit_gen() % 10);
+	const long nines[] = { 9, 9 };
+	auto at_least = [](int x, long y) { return x >= y; };
+	if (parallel_find_end(digits.begin(), digits.end(), begin(nines), end(nines), at_least)
+		!= find_end(digits.begin(), digits.end(), begin(nines), end(nines), at_least))
+		cout << "parallel_find_end: differs from find_end" << endl;
+	return rc;
+}
@@ -0,0 +1,112 @@
+// parallel_partition.cpp
+// std::partition / std::stable_partition against parallel_partition and
+// parallel_stable_partition, with a cheap predicate (odd) and an expensive
+// one (a chain of multiply-xorshift rounds), from 250K to 256M ints.
+// Use --filter with a size, e.g. --filter n=256M, to run one size only.
+#include "dx/ppl.h"
+#include "dx/partition.h"
+#include "dx/bench.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+
+using namespace dx;
+using namespace std;
+
+bool is_odd(int x)
+{
+	return (x & 1) != 0;
+}
+
+// Costs some fifty cycles of dependent multiplies per element.
+bool is_expensive_match(int x)
+{
+	uint32_t h = uint32_t(x);
+	for (int i = 0; i < 8; ++i)
+	{
+		h ^= h >> 15;
+		h *= 0x2c1b3c6du;
+		h ^= h >> 12;
+	}
+	return (h & 3) == 0;
+}
+
+// Whether data is input partitioned by pred at mid and, if stable, keeps
+// the input order within either group.
+template <class Pred>
+bool check(const vector<int>& input, const vector<int>& data, vector<int>::const_iterator mid, Pred pred,
+	bool stable)
+{
+	if (!is_partitioned(data.begin(), data.end(), pred) || mid != partition_point(data.begin(), data.end(), pred))
+		return false;
+	if (!stable)
+	{
+		vector<int> a = input, b = data;
+		sort(a.begin(), a.end());
+		sort(b.begin(), b.end());
+		return a == b;
+	}
+	vector<int> expect = input;
+	std::stable_partition(expect.begin(), expect.end(), pred);
+	return expect == data;
+}
+
+int main(int argc, char* argv[])
+{
+	struct size_case
+	{
+		size_t n;
+		const char* name;
+	};
+	const size_case sizes[] = { { 250000, "n=250K" }, { size_t(4) << 20, "n=4M" },
+		{ size_t(64) << 20, "n=64M" }, { size_t(256) << 20, "n=256M" } };
+
+	// One input at a time: the one of the size the next benchmark needs.
+	auto input = make_shared<vector<int>>();
+	auto data = make_shared<vector<int>>();
+	auto prepare = [=](size_t n) {
+		if (input->size() != n)
+		{
+			input->resize(n);
+			generate(input->begin(), input->end(), mt19937(42));
+		}
+		*data = *input;
+	};
+
+	{
+		prepare(sizes[0].n);
+		bool ok = check(*input, *data, parallel_partition(data->begin(), data->end(), is_odd), is_odd, false);
+		*data = *input;
+		ok = ok && check(*input, *data, parallel_stable_partition(data->begin(), data->end(), is_odd), is_odd, true);
+		if (!ok)
+		{
+			cerr << "parallel partition is wrong" << endl;
+			return 1;
+		}
+	}
+
+	bench::suite suite("parallel_partition", 1, 5);
+	for (const size_case& s : sizes)
+	{
+		const size_t n = s.n;
+		auto reset = [=] { prepare(n); };
+		for (int expensive = 0; expensive < 2; ++expensive)
+		{
+			bool (*pred)(int) = expensive ? is_expensive_match : is_odd;
+			const string tag = string(expensive ? " expensive " : " cheap ") + s.name;
+			suite.group(tag);
+			suite.add_serial("std::partition" + tag, reset, [=] { std::partition(data->begin(), data->end(), pred); });
+			suite.add("parallel_partition" + tag, reset, [=] { parallel_partition(data->begin(), data->end(), pred); });
+			suite.add_serial("std::stable_partition" + tag, reset, [=] {
+				std::stable_partition(data->begin(), data->end(), pred);
+			});
+			suite.add("parallel_stable_partition" + tag, reset, [=] {
+				parallel_stable_partition(data->begin(), data->end(), pred);
+			});
+		}
+	}
+	return suite.run(argc, argv);
+}
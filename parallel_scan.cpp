@@ -0,0 +1,97 @@
+// parallel_scan.cpp
+// Prefix sums over the 0x200000-element dataset of the sort samples:
+// std::partial_sum against parallel_inclusive_scan and
+// parallel_exclusive_scan, out of place and in place, plus a running
+// maximum that goes through the generic (non-SIMD) path.
+#include "dx/ppl.h"
+#include "dx/scan.h"
+#include "dx/bench.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+using namespace dx;
+using namespace std;
+
+const size_t DATASET_SIZE = 0x200000;
+
+// Creates the dataset for this example. Each call
+// produces the same predefined sequence of random data.
+vector<size_t> GetData()
+{
+	vector<size_t> data(DATASET_SIZE);
+	generate(begin(data), end(data), mt19937(42));
+	return data;
+}
+
+int main(int argc, char* argv[])
+{
+	const vector<size_t> input = GetData();
+	vector<uint32_t> input32(begin(input), end(input));
+	vector<size_t> data, out(DATASET_SIZE);
+	vector<uint32_t> data32, out32(DATASET_SIZE);
+	auto max_op = [](size_t a, size_t b) { return a < b ? b : a; };
+
+	// Check every variant against the serial algorithms once.
+	{
+		vector<size_t> expect(DATASET_SIZE);
+		partial_sum(begin(input), end(input), begin(expect));
+		parallel_inclusive_scan(begin(input), end(input), begin(out));
+		bool ok = out == expect;
+		data = input;
+		parallel_inclusive_scan(begin(data), end(data), begin(data));
+		ok = ok && data == expect;
+		parallel_exclusive_scan(begin(input), end(input), begin(out), size_t(7));
+		exclusive_scan(begin(input), end(input), begin(expect), size_t(7));
+		ok = ok && out == expect;
+		partial_sum(begin(input), end(input), begin(expect), max_op);
+		parallel_inclusive_scan(begin(input), end(input), begin(out), max_op);
+		ok = ok && out == expect;
+		vector<uint32_t> expect32(DATASET_SIZE);
+		partial_sum(begin(input32), end(input32), begin(expect32));
+		parallel_inclusive_scan(begin(input32), end(input32), begin(out32));
+		ok = ok && out32 == expect32;
+		// int elements summed in long long: the block totals must not
+		// overflow in int.
+		vector<int> quarters(DATASET_SIZE, INT_MAX / 4);
+		vector<long long> wide(DATASET_SIZE), expect_wide(DATASET_SIZE);
+		parallel_inclusive_scan(begin(quarters), end(quarters), begin(wide), plus<>(), 0LL);
+		inclusive_scan(begin(quarters), end(quarters), begin(expect_wide), plus<>(), 0LL);
+		ok = ok && wide == expect_wide;
+		parallel_exclusive_scan(begin(quarters), end(quarters), begin(wide), 0LL);
+		exclusive_scan(begin(quarters), end(quarters), begin(expect_wide), 0LL);
+		ok = ok && wide == expect_wide;
+		if (!ok)
+		{
+			cerr << "parallel scan does not match the serial scan" << endl;
+			return 1;
+		}
+	}
+
+	auto reset = [&] { data = input; };
+	auto reset32 = [&] { data32 = input32; };
+	bench::suite suite("parallel_scan");
+	suite.add_serial("std::partial_sum", [&] { partial_sum(begin(input), end(input), begin(out)); });
+	suite.add("parallel_inclusive_scan", [&] { parallel_inclusive_scan(begin(input), end(input), begin(out)); });
+	suite.add("parallel_exclusive_scan", [&] {
+		parallel_exclusive_scan(begin(input), end(input), begin(out), size_t(0));
+	});
+	suite.add_serial("std::partial_sum in place", reset, [&] { partial_sum(begin(data), end(data), begin(data)); });
+	suite.add("parallel_inclusive_scan in place", reset, [&] {
+		parallel_inclusive_scan(begin(data), end(data), begin(data));
+	});
+	suite.add_serial("std::partial_sum uint32 in place", reset32, [&] {
+		partial_sum(begin(data32), end(data32), begin(data32));
+	});
+	suite.add("parallel_inclusive_scan uint32 in place", reset32, [&] {
+		parallel_inclusive_scan(begin(data32), end(data32), begin(data32));
+	});
+	suite.add_serial("std::partial_sum max", [&] { partial_sum(begin(input), end(input), begin(out), max_op); });
+	suite.add("parallel_inclusive_scan max", [&] {
+		parallel_inclusive_scan(begin(input), end(input), begin(out), max_op);
+	});
+	return suite.run(argc, argv);
+}
@@ -0,0 +1,219 @@
+// parallel_tiled_bitonic_sort.cpp
+// The tiled bitonic sort of dx_amp/BitonicSort.cpp on CPU workers.
+//
+// The n = width * height elements are a matrix of rows of `width`. A row
+// plays the part of a tile_static tile: one worker runs every step of a
+// level that stays inside the row while the row sits in L2. Steps that
+// span rows become steps inside the rows of the transposed matrix, so each
+// level above the row length is: blocked transpose, the cross-row steps
+// on the transposed rows, blocked transpose back, the in-row steps. Rows
+// are ROW_SIZE elements, so only the levels above 64K elements pay for
+// the transposes: 10 of the 26 levels for 64M elements.
+#include "dx/ppl.h"
+#include "dx/bench.h"
+#include "dx/bitonic_sort.h"
+#include "dx/parallel_sort.h"
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace dx;
+using namespace std;
+
+// Square blocks of the transposes, as TRANSPOSE_BLOCK_SIZE in the AMP
+// version: a 32 x 32 block of ints is 4 KB on each side. Blocks are
+// grouped into TRANSPOSE_TILE squares so that every page of input and
+// output a tile touches gives it a kilobyte, not one 128-byte block row.
+const int TRANSPOSE_BLOCK = 32;
+const int TRANSPOSE_TILE = 256;
+
+// Elements of a row, the tile a worker sorts on its own: 256 KB of ints,
+// which stays in L2. Rows are made longer when n needs it for the
+// transposed rows to be no longer than a row.
+const size_t ROW_SIZE = 64 * 1024;
+
+// Runs steps first_step, first_step / 2, ..., 1 of the bitonic network on
+// one tile of len elements whose first element has network index base.
+// An element at index i sorts ascending where (i & dir_mask) == 0. From
+// step 16 down, 32-element blocks share a direction once dir_mask >= 32
+// and go through the vector networks.
+template <class T>
+void merge_tile(T* tile, int len, size_t base, int first_step, size_t dir_mask)
+{
+	for (int j = first_step; j > 0; j /= 2)
+	{
+		if (j == 16 && dir_mask >= 32 && len % 32 == 0)
+		{
+			bool vectors = true;
+			for (int b = 0; vectors && b < len; b += 32)
+			{
+				vectors = network_merge(tile + b, 32, ((base + b) & dir_mask) == 0);
+			}
+			if (vectors)
+			{
+				return;
+			}
+		}
+		// dir_mask > j, so each run of 2j elements has one direction and
+		// its two halves are compared lane by lane.
+		for (int b = 0; b < len; b += 2 * j)
+		{
+			T* lo = tile + b;
+			T* hi = lo + j;
+			bool ascending = ((base + b) & dir_mask) == 0;
+			if (network_exchange(lo, hi, j, ascending))
+			{
+				continue;
+			}
+			if (ascending)
+			{
+				for (int i = 0; i < j; ++i)
+				{
+					T x = lo[i], y = hi[i];
+					bool less = y < x;
+					lo[i] = less ? y : x;
+					hi[i] = less ? x : y;
+				}
+			}
+			else
+			{
+				for (int i = 0; i < j; ++i)
+				{
+					T x = lo[i], y = hi[i];
+					bool less = y < x;
+					lo[i] = less ? x : y;
+					hi[i] = less ? y : x;
+				}
+			}
+		}
+	}
+}
+
+// out (cols x rows) = transpose of in (rows x cols), one TRANSPOSE_TILE
+// square per task. Each block is copied through a local buffer, like the
+// tile_static buffer of transpose_kernel: with power-of-two strides the
+// lines of a block all map to the same cache set, so the block is read
+// and written a whole row at a time instead of element by element.
+template <class T>
+void blocked_transpose(const T* in, T* out, int rows, int cols)
+{
+	int bands = (rows + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+	int tiles = (cols + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+	parallel_for(0, bands * tiles, [=](int tile) {
+		T block[TRANSPOSE_BLOCK][TRANSPOSE_BLOCK];
+		int t0 = tile / tiles * TRANSPOSE_TILE;
+		int t1 = min(rows, t0 + TRANSPOSE_TILE);
+		int u0 = tile % tiles * TRANSPOSE_TILE;
+		int u1 = min(cols, u0 + TRANSPOSE_TILE);
+		for (int r0 = t0; r0 < t1; r0 += TRANSPOSE_BLOCK)
+		{
+			int nr = min(t1 - r0, TRANSPOSE_BLOCK);
+			for (int c0 = u0; c0 < u1; c0 += TRANSPOSE_BLOCK)
+			{
+				int nc = min(u1 - c0, TRANSPOSE_BLOCK);
+				for (int r = 0; r < nr; ++r)
+				{
+					const T* src = in + size_t(r0 + r) * cols + c0;
+					for (int c = 0; c < nc; ++c)
+					{
+						block[c][r] = src[c];
+					}
+				}
+				for (int c = 0; c < nc; ++c)
+				{
+					copy(block[c], block[c] + nr, out + size_t(c0 + c) * rows + r0);
+				}
+			}
+		}
+	});
+}
+
+// Sorts data[0, n) in increasing order. n must be a power of two; other
+// sizes go to parallel_bitonic_sort.
+template <class T>
+void parallel_tiled_bitonic_sort(T* data, size_t n)
+{
+	if (n < 2 || (n & (n - 1)) != 0)
+	{
+		parallel_bitonic_sort(data, ptrdiff_t(n));
+		return;
+	}
+	int width = int(min(n, ROW_SIZE));
+	while (size_t(width) * width < n)
+	{
+		width *= 2;
+	}
+	int height = int(n / width);
+
+	// Levels up to the row length: every row sorted on its own, in the
+	// direction of its index.
+	parallel_for(0, height, [=](int r) {
+		T* row = data + size_t(r) * width;
+		int first = 2;
+		if (width >= 32 && network_sort(row, 32, (size_t(r) * width & 32) == 0))
+		{
+			for (int b = 32; b < width; b += 32)
+			{
+				network_sort(row + b, 32, ((size_t(r) * width + b) & 32) == 0);
+			}
+			first = 64;
+		}
+		for (int level = first; level <= width; level *= 2)
+		{
+			merge_tile(row, width, size_t(r) * width, level / 2, size_t(level));
+		}
+	});
+
+	// Longer levels: the steps of a row length and up compare rows r and
+	// r ^ (step / width) at the same column, i.e. neighbours at distance
+	// step / width inside a row of the transposed matrix.
+	vector<T> temp(n);
+	T* t = temp.data();
+	for (size_t level = size_t(width) * 2; level <= n; level *= 2)
+	{
+		blocked_transpose(data, t, height, width);
+		parallel_for(0, width, [=](int c) {
+			merge_tile(t + size_t(c) * height, height, 0, int(level / 2 / width), level / width);
+		});
+		blocked_transpose(t, data, width, height);
+		parallel_for(0, height, [=](int r) {
+			merge_tile(data + size_t(r) * width, width, size_t(r) * width, width / 2, level);
+		});
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const int sizes[] = { 1024 * 1024, 64 * 1024 * 1024 };
+	const char* labels[] = { "1M", "64M" };
+	const int count = sizeof(sizes) / sizeof(sizes[0]);
+
+	// Every trial sorts a fresh copy of the same random input.
+	vector<int> input[count], a[count];
+	mt19937 gen(42);
+	bench::suite suite("parallel_tiled_bitonic_sort", 1, 3);
+	for (int s = 0; s < count; ++s)
+	{
+		const int size = sizes[s];
+		input[s].resize(size);
+		generate(input[s].begin(), input[s].end(), gen);
+		vector<int>& items = a[s];
+		auto reset = [&input, &items, s] { items = input[s]; };
+		string label = string(" ") + labels[s];
+		suite.group(labels[s]);
+		suite.add("parallel_sort" + label, reset, [&items] { parallel_sort(items.begin(), items.end()); });
+		suite.add("parallel_bitonic_sort" + label, reset, [&items, size] { parallel_bitonic_sort(items.data(), size); });
+		suite.add("parallel_tiled_bitonic_sort" + label, reset, [&items, size] { parallel_tiled_bitonic_sort(items.data(), size); });
+	}
+	int rc = suite.run(argc, argv);
+	for (int s = 0; s < count; ++s)
+	{
+		if (!a[s].empty())
+		{
+			cout << labels[s] << ": " << (is_sorted(a[s].begin(), a[s].end()) ? "sorted" : "NOT sorted") << endl;
+		}
+	}
+	return rc;
+}
@@ -3,47 +3,49 @@
 #include <algorithm>
 #include <iostream>
 #include <list>
-#include <set>
-#include <map>
 #include <iterator>
-#include <ppl.h>
-#include <Windows.h>
+#include "dx/ppl.h"
+#include "dx/bench.h"
+#include "dx/csr_graph.h"
+#include "dx/k_shortest_paths.h"
+#include "dx/path_state.h"
+#include "dx/top_k.h"
 #include <mutex>
+#include <random>
 #include <thread>
-#include "d:/WorkSpace/Dxh/RingQueue.h"
 
 using namespace std;
-using namespace concurrency;
-
-typedef map<int, int> map_travel_record; // node ptr, sequence no.
-typedef map_travel_record::value_type node_with_seq;
-
-namespace std{
-	template<>
-	struct less<node_with_seq> :public binary_function <node_with_seq, node_with_seq, bool>
-	{
-		inline bool operator ()(node_with_seq const &left, node_with_seq const &right) const {
-			return left.second < right.second;
-		}
-	};
-}
+using namespace dx;
 
 typedef vector<vector<int>> adj_list; // neighbour list table.
 
+// Routes shorter than this fork a branch per neighbour; longer ones are
+// searched depth first within their branch.
+const size_t g_fork_depth = 4;
+
 template <typename Pred>
 int Travel_map(adj_list const &topo,
-	map_travel_record rec,
+	path_state &rec,
 	int node_next,
-	Pred &f_term)
+	Pred const &f_term,
+	path_arenas &arenas)
 {
-	if (rec.find(node_next) == rec.end() && !f_term(node_next, rec)) {		
-		size_t no = rec.size();
-		rec.insert(make_pair(node_next, no));
-		// for node_n in adj_list[node_next]. fork Travel_map(topo, rec, node_n, f_term);
-		parallel_for(std::size_t(0), topo[node_next].size(),
-			[&topo, rec, node_next, &f_term](int n) {
-			Travel_map(topo, rec, topo[node_next][n], f_term);
-		});
+	if (!rec.contains(node_next) && !f_term(node_next, rec)) {
+		rec.push(arenas.local(), node_next);
+		vector<int> const &next = topo[node_next];
+		if (rec.size() < g_fork_depth) {
+			// for node_n in adj_list[node_next]. fork Travel_map(topo, rec, node_n, f_term);
+			parallel_for(std::size_t(0), next.size(), [&](std::size_t n) {
+				path_state branch = rec.fork(arenas.local());
+				Travel_map(topo, branch, next[n], f_term, arenas);
+			});
+		}
+		else {
+			for (int node_n : next) {
+				Travel_map(topo, rec, node_n, f_term, arenas);
+			}
+		}
+		rec.pop();
 		return 0;
 	}
 	else {
@@ -52,50 +54,23 @@ int Travel_map(adj_list const &topo,
 	return 1;
 }
 
-std::mutex g_io_mutex;
-
 const int g_best_count = 5;
-int g_best_route_size = 10; // max length of the best_routes.
-static RingQueue<vector<int>, g_best_count> g_best_rotues;
-// Return true if replaced best; false if discarded.
-bool check_best(vector<int> const &route) {
-	if (g_best_rotues.size() < g_best_count) {
-		g_best_rotues.push_back(route);
-		//g_best_route_size = route.size();
-		return true;
-	}
-	int k = 0;
-	for (int i = 0; i < g_best_count; ++i){
-		if (g_best_rotues[i].size() > g_best_rotues[k].size()) {
-			k = i;
-		}
-	}
-	if (route.size() < g_best_rotues[k].size()) {
-		g_best_rotues[k] = route;
-		g_best_route_size = route.size();
-		return true;
-	}
-	return false;
-}
+const int g_best_route_size = 10; // max length of the best_routes.
+// The best routes by node count, kept by any worker without a lock.
+static concurrent_top_k<vector<int>> g_best_routes(g_best_count, g_best_route_size + 1);
 
-// find the 5 best path in all path.
-bool is_done(int dstNode, int curNode, map_travel_record const &route) {
-	// Test exclude 
-	if (route.size() > g_best_route_size){
-		return false;
+// find the 5 best path in all path. True ends the branch at curNode.
+bool is_done(int dstNode, int curNode, path_state const &route) {
+	// The route through curNode has route.size() + 1 nodes; prune it once
+	// that cannot beat the 5th best so far.
+	if (route.size() + 1 >= g_best_routes.bound()) {
+		return true;
 	}
 	if (dstNode == curNode) {
-		std::set<node_with_seq> result;
-		copy(route.begin(), route.end(), inserter(result, result.begin()));
-		// Test
-		std::lock_guard<std::mutex> lock(g_io_mutex);
-		//cout << "Route[" << 1 + route.size() << "]:";
-		vector<int> route_nodes;
-		for (auto x : result) {
-			route_nodes.push_back(x.first);
-		}
+		vector<int> route_nodes = route.nodes();
 		route_nodes.push_back(curNode);
-		return check_best(route_nodes);
+		g_best_routes.insert(uint32_t(route_nodes.size()), std::move(route_nodes));
+		return true;
 	}
 	return false;
 }
@@ -132,11 +107,9 @@ bool remove_edge(adj_list & topo, int a, int b) {
 	topo[b].erase(ib);
 	return true;
 }
-
-int main()
-{
+// n x n grid, node n * r + c at row r, column c.
+adj_list grid_topo(int n) {
 	adj_list topo;
-	const int n = 5;
 	for (int r = 0; r < n; ++r) {
 		for (int c = 0; c < n; ++c) {
 			if (c < n - 1)
@@ -145,25 +118,186 @@ int main()
 				add_edge(topo, n * r + c, n * (r + 1) + c);
 		}
 	}
+	return topo;
+}
+// The same grid staged into g, a row per task.
+void grid_topo(csr_graph &g, int n) {
+	parallel_for(0, n, [&g, n](int r) {
+		vector<pair<uint32_t, uint32_t>> edges;
+		for (int c = 0; c < n; ++c) {
+			if (c < n - 1)
+				edges.emplace_back(n * r + c, n * r + c + 1);
+			if (r < n - 1)
+				edges.emplace_back(n * r + c, n * (r + 1) + c);
+		}
+		g.insert_edges(edges.begin(), edges.end());
+	});
+}
+
+int main(int argc, char* argv[])
+{
+	adj_list topo = grid_topo(5);
 	remove_edge(topo, 7, 12);
 	remove_edge(topo, 11, 12);
 	remove_edge(topo, 13, 12);
 
-	map_travel_record route;
 	int iEndNe = 21;
-	__int64 begin = GetTickCount();
 
-	Travel_map(topo, route, 0,
-		[iEndNe](int curNode, map_travel_record const &route) {
-		return is_done(iEndNe, curNode, route);	});
-	cout << (GetTickCount() - begin) << "ms\n";
-	for (int i = 0; i < g_best_rotues.size(); ++i) {
-		cout << "Route[" << 1 + g_best_rotues[i].size() << "]:";
-		for (auto x : g_best_rotues[i]) {
+	bench::suite suite("parallel_topo_path");
+	suite.add("Travel_map", [] {
+		// Every trial searches from scratch.
+		g_best_routes.clear();
+	}, [&] {
+		// Path links and bitsets live until the search is over.
+		path_arenas arenas;
+		path_state route(arenas.local(), topo.size());
+		Travel_map(topo, route, 0,
+			[iEndNe](int curNode, path_state const &route) {
+			return is_done(iEndNe, curNode, route);	}, arenas);
+	});
+	vector<vector<int>> best_paths;
+	suite.add("k_shortest_simple_paths", [&] {
+		best_paths = k_shortest_simple_paths(topo, 0, iEndNe, g_best_count);
+	});
+
+	// Far beyond exhaustive enumeration: corner to corner of 10^6 nodes.
+	const int side = 1000;
+	adj_list grid;
+	vector<vector<int>> grid_paths;
+	suite.group("1000x1000 grid");
+	suite.add("k_shortest_simple_paths", [&] {
+		if (grid.empty())
+			grid = grid_topo(side);
+	}, [&] {
+		grid_paths = k_shortest_simple_paths(grid, 0, side * side - 1, g_best_count);
+	});
+	csr_snapshot grid_csr;
+	vector<vector<int>> csr_paths;
+	suite.add("k_shortest_simple_paths csr", [&] {
+		if (grid_csr.size() == 0) {
+			csr_graph g;
+			grid_topo(g, side);
+			grid_csr = g.commit();
+		}
+	}, [&] {
+		csr_paths = k_shortest_simple_paths(grid_csr, 0, side * side - 1, g_best_count);
+	});
+
+	// Build the grid, then cut every third horizontal edge of every row.
+	suite.group("1000x1000 grid updates");
+	suite.add_serial("adj_list add_edge/remove_edge", [&] {
+		adj_list t = grid_topo(side);
+		for (int r = 0; r < side; ++r)
+			for (int c = r % 3; c < side - 1; c += 3)
+				remove_edge(t, side * r + c, side * r + c + 1);
+	});
+	size_t cut_edges = 0, updated_edges = 0;
+	for (int r = 0; r < side; ++r)
+		cut_edges += (side - 1 - r % 3 + 2) / 3;
+	suite.add("csr_graph batches", [&] {
+		csr_graph g;
+		grid_topo(g, side);
+		g.commit();
+		parallel_for(0, side, [&g, side](int r) {
+			vector<pair<uint32_t, uint32_t>> cut;
+			for (int c = r % 3; c < side - 1; c += 3)
+				cut.emplace_back(side * r + c, side * r + c + 1);
+			g.erase_edges(cut.begin(), cut.end());
+		});
+		updated_edges = g.commit().edges();
+	});
+
+	// 64 threads offer random route costs to one top 5 at once.
+	const int contenders = 64, offers = 4096;
+	vector<vector<uint32_t>> offered(contenders);
+	mt19937 gen(42);
+	for (auto &costs : offered) {
+		for (int i = 0; i < offers; ++i)
+			costs.push_back(gen() % 1000000);
+	}
+	auto contend = [&](auto const &offer) {
+		vector<thread> threads;
+		for (int t = 0; t < contenders; ++t) {
+			threads.emplace_back([&offered, &offer, t] {
+				for (uint32_t cost : offered[t])
+					offer(cost, t);
+			});
+		}
+		for (auto &th : threads)
+			th.join();
+	};
+	suite.group("top-5 insert, 64 threads");
+	std::mutex scan_mutex;
+	vector<pair<uint32_t, int>> scanned;
+	suite.add_serial("mutex + linear scan", [&] {
+		scanned.clear();
+		contend([&](uint32_t cost, int t) {
+			std::lock_guard<std::mutex> lock(scan_mutex);
+			if (scanned.size() < g_best_count) {
+				scanned.emplace_back(cost, t);
+				return;
+			}
+			auto worst = max_element(scanned.begin(), scanned.end());
+			if (cost < worst->first)
+				*worst = make_pair(cost, t);
+		});
+	});
+	concurrent_top_k<int> collected(g_best_count);
+	suite.add_serial("concurrent_top_k", [&] {
+		collected.clear();
+		contend([&](uint32_t cost, int t) { collected.insert(cost, t); });
+	});
+	int rc = suite.run(argc, argv);
+	auto best_routes = g_best_routes.sorted();
+	for (auto const &route : best_routes) {
+		cout << "Route[" << 1 + route.second.size() << "]:";
+		for (auto x : route.second) {
+			cout << x << ",";
+		}
+		cout << endl;
+	}
+	for (auto const &path : best_paths) {
+		cout << "k_shortest[" << path.size() << "]:";
+		for (auto x : path) {
 			cout << x << ",";
 		}
 		cout << endl;
 	}
-	return 0;
+	if (!best_paths.empty()) {
+		// Same lengths as the exhaustive search found.
+		vector<size_t> travel_sizes, best_sizes;
+		for (auto const &route : best_routes)
+			travel_sizes.push_back(route.second.size());
+		for (auto const &path : best_paths)
+			best_sizes.push_back(path.size());
+		sort(travel_sizes.begin(), travel_sizes.end());
+		if (!travel_sizes.empty() && travel_sizes != best_sizes)
+			cout << "k_shortest_simple_paths: lengths differ from Travel_map" << endl;
+	}
+	if (!grid_paths.empty()) {
+		cout << "1000x1000 grid: " << grid_paths.size() << " routes of " << grid_paths.front().size() << ".."
+			<< grid_paths.back().size() << " nodes" << endl;
+	}
+	if (!grid_paths.empty() && !csr_paths.empty() && grid_paths.front().size() != csr_paths.front().size())
+		cout << "k_shortest_simple_paths csr: lengths differ" << endl;
+	if (updated_edges != 0 && updated_edges != size_t(2 * side * (side - 1)) - cut_edges)
+		cout << "csr_graph batches: wrong edge count " << updated_edges << endl;
+	// Both collectors keep the g_best_count lowest of all offered costs.
+	vector<uint32_t> all;
+	for (auto const &costs : offered)
+		all.insert(all.end(), costs.begin(), costs.end());
+	partial_sort(all.begin(), all.begin() + g_best_count, all.end());
+	auto check_costs = [&](const char *name, vector<pair<uint32_t, int>> kept) {
+		if (kept.empty())
+			return;
+		sort(kept.begin(), kept.end());
+		if (kept.size() != size_t(g_best_count)
+			|| !equal(kept.begin(), kept.end(), all.begin(),
+				[](pair<uint32_t, int> const &c, uint32_t cost) { return c.first == cost; }))
+			cout << name << ": wrong costs" << endl;
+	};
+	check_costs("mutex + linear scan", scanned);
+	check_costs("concurrent_top_k", collected.sorted());
+	return rc;
 
 }
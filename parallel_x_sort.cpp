@@ -1,23 +1,13 @@
 // choosing-parallel-sort.cpp 
 // compile with: /EHsc
-#include <ppl.h>
+#include "dx/ppl.h"
+#include "dx/bench.h"
 #include <random>
 #include <iostream>
-#include <windows.h>
 
-using namespace concurrency;
+using namespace dx;
 using namespace std;
 
-// Calls the provided work function and returns the number of milliseconds  
-// that it takes to call that function. 
-template <class Function>
-__int64 time_call(Function&& f)
-{
-	__int64 begin = GetTickCount();
-	f();
-	return GetTickCount() - begin;
-}
-
 const size_t DATASET_SIZE = 0x200000;
 
 // Create 
@@ -30,33 +20,20 @@ vector<size_t> GetData()
 	return data;
 }
 
-int wmain()
+int main(int argc, char* argv[])
 {
-	// Use std::sort to sort the data.
-	auto data = GetData();
-	wcout << "Testing std::sort...";
-	auto elapsed = time_call([&data] { sort(begin(data), end(data)); });
-	wcout << " took " << elapsed << " ms." << endl;
-
-	// Use concurrency::parallel_sort to sort the data.
-	data = GetData();
-	wcout << "Testing concurrency::parallel_sort...";
-	elapsed = time_call([&data] { parallel_sort(begin(data), end(data)); });
-	wcout << " took " << elapsed << " ms." << endl;
-
-	// Use concurrency::parallel_buffered_sort to sort the data.
-	data = GetData();
-	wcout << "Testing concurrency::parallel_buffered_sort...";
-	elapsed = time_call([&data] { parallel_buffered_sort(begin(data), end(data)); });
-	wcout << " took " << elapsed << " ms." << endl;
-
-	// Use concurrency::parallel_radixsort to sort the data.
-	data = GetData();
-	wcout << "Testing concurrency::parallel_radixsort...";
-	elapsed = time_call([&data] { parallel_radixsort(begin(data), end(data)); });
-	wcout << " took " << elapsed << " ms." << endl;
+	const vector<size_t> input = GetData();
+	vector<size_t> data;
+	auto reset = [&] { data = input; };
+
+	bench::suite suite("parallel_x_sort");
+	suite.add_serial("std::sort", reset, [&] { sort(begin(data), end(data)); });
+	suite.add("parallel_sort", reset, [&] { parallel_sort(begin(data), end(data)); });
+	suite.add("parallel_buffered_sort", reset, [&] { parallel_buffered_sort(begin(data), end(data)); });
+	suite.add("parallel_radixsort", reset, [&] { parallel_radixsort(begin(data), end(data)); });
+	return suite.run(argc, argv);
 }
-/* Sample output (on a computer that has four cores):
+/* Output of the earlier single-run version (on a computer that has four cores):
 Testing std::sort... took 2906 ms.
 Testing concurrency::parallel_sort... took 2234 ms.
 Testing concurrency::parallel_buffered_sort... took 1782 ms.